@@ -0,0 +1,104 @@
+#ifndef BenchmarkHarness_HeaderPlusPlus
+#define BenchmarkHarness_HeaderPlusPlus
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Times benchmarked operations and writes the results as JSON, to stdout or to
+//the file named on the command line, so each can be tracked on its own.
+struct Harness
+{
+	struct Result final
+	{
+		std::string name;
+		std::size_t size;
+		std::uint64_t iterations;
+		double ns_per_op;
+		std::vector<std::pair<char const *, double>> counters;
+	};
+	std::vector<Result> Results;
+	std::chrono::nanoseconds const MIN_TIME = std::chrono::milliseconds(200);
+
+	//Runs op in doubling batches until a batch takes at least MIN_TIME
+	template<typename Op>
+	void Run(char const *name, std::size_t size, Op &&op)
+	{
+		using clock = std::chrono::steady_clock;
+		for(std::uint64_t iterations = 1; ; iterations *= 2)
+		{
+			auto const start = clock::now();
+			for(std::uint64_t i = 0; i < iterations; ++i)
+			{
+				op(i);
+			}
+			auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+			if(elapsed >= MIN_TIME)
+			{
+				return Record(name, size, iterations, elapsed);
+			}
+		}
+	}
+	//Runs op on fresh state from setup until the runs of op add up to
+	//MIN_TIME, for operations that use up what they work on; setup is not timed
+	template<typename Setup, typename Op>
+	void RunEach(char const *name, std::size_t size, Setup &&setup, Op &&op)
+	{
+		using clock = std::chrono::steady_clock;
+		std::uint64_t iterations = 0;
+		std::chrono::nanoseconds elapsed {0};
+		while(elapsed < MIN_TIME)
+		{
+			setup();
+			auto const start = clock::now();
+			op();
+			elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+			++iterations;
+		}
+		Record(name, size, iterations, elapsed);
+	}
+
+	std::string Json() const
+	{
+		std::ostringstream out;
+		out << "{\"benchmarks\": [";
+		for(std::size_t i = 0; i < Results.size(); ++i)
+		{
+			Result const &r = Results[i];
+			out << (i ? "," : "") << "\n\t{\"name\": \"" << r.name << "\", \"size\": " << r.size
+			    << ", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.ns_per_op;
+			for(auto const &counter : r.counters)
+			{
+				out << ", \"" << counter.first << "\": " << counter.second;
+			}
+			out << "}";
+		}
+		out << "\n]}\n";
+		return out.str();
+	}
+	void Write(int nargs, char const *const *args) const
+	{
+		if(nargs > 1)
+		{
+			std::ofstream (args[1]) << Json();
+		}
+		else
+		{
+			std::cout << Json();
+		}
+	}
+
+private:
+	void Record(char const *name, std::size_t size, std::uint64_t iterations, std::chrono::nanoseconds elapsed)
+	{
+		Results.push_back(Result{name, size, iterations, double(elapsed.count())/iterations, {}});
+		std::cerr << name << " [" << size << "] " << Results.back().ns_per_op << " ns/op" << std::endl;
+	}
+};
+
+#endif
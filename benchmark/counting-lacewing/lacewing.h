@@ -0,0 +1,266 @@
+#ifndef CountingLacewing_HeaderPlusPlus
+#define CountingLacewing_HeaderPlusPlus
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Stands in for lacewing.h in relay-server-bench, covering only what the
+//server uses. Nothing touches the network: posted callbacks run when the
+//benchmark runs a pump iteration, timers never fire on their own, and server
+//clients count the sends and packets their writes would take.
+
+#define lw_callback
+
+inline char const *lw_version()
+{
+	return "counting lacewing";
+}
+
+namespace lacewing
+{
+	struct _error final
+	{
+		std::string text;
+
+		void add(char const *format, ...)
+		{
+			char buffer[256];
+			va_list args;
+			va_start(args, format);
+			std::vsnprintf(buffer, sizeof(buffer), format, args);
+			va_end(args);
+			text += buffer;
+		}
+		char const *tostring()
+		{
+			return text.c_str();
+		}
+	};
+	using error = _error *;
+	inline error error_new()
+	{
+		return new _error;
+	}
+	inline void error_delete(error e)
+	{
+		delete e;
+	}
+
+	struct _address final
+	{
+	};
+	using address = _address *;
+
+	struct _filter final
+	{
+		long port = 0;
+
+		void local_port(long p)
+		{
+			port = p;
+		}
+	};
+	using filter = _filter *;
+	inline filter filter_new()
+	{
+		return new _filter;
+	}
+	inline void filter_delete(filter f)
+	{
+		delete f;
+	}
+
+	struct _pump final
+	{
+		std::vector<std::pair<void (*)(void *), void *>> posted;
+
+		void post(void *function, void *param)
+		{
+			posted.emplace_back(reinterpret_cast<void (*)(void *)>(function), param);
+		}
+		//Runs one iteration: everything posted before it started
+		void run()
+		{
+			std::vector<std::pair<void (*)(void *), void *>> ready;
+			ready.swap(posted);
+			for(auto const &p : ready)
+			{
+				p.first(p.second);
+			}
+		}
+	};
+	using pump = _pump *;
+	using eventpump = _pump *;
+	inline eventpump eventpump_new()
+	{
+		return new _pump;
+	}
+	inline void pump_delete(pump p)
+	{
+		delete p;
+	}
+
+	struct _timer;
+	using timer = _timer *;
+	struct _timer final
+	{
+		void *user = nullptr;
+		void (*handler)(timer) = nullptr;
+		bool running = false;
+
+		void tag(void *t)
+		{
+			user = t;
+		}
+		void *tag()
+		{
+			return user;
+		}
+		void on_tick(void (*h)(timer))
+		{
+			handler = h;
+		}
+		void start(long)
+		{
+			running = true;
+		}
+		void stop()
+		{
+			running = false;
+		}
+		bool started()
+		{
+			return running;
+		}
+	};
+	inline timer timer_new(pump)
+	{
+		return new _timer;
+	}
+	inline void timer_delete(timer t)
+	{
+		delete t;
+	}
+
+	//A connection on a link that drains instantly. Writes made while corked
+	//go out as one send when uncorked, as lacewing coalesces them.
+	struct _server_client final
+	{
+		static constexpr std::size_t MSS = 1448;
+		void *user = nullptr;
+		bool corked = false, closed = false;
+		std::size_t held = 0; //written while corked
+		std::uint64_t sends = 0, packets = 0, bytes = 0;
+
+		void tag(void *t)
+		{
+			user = t;
+		}
+		void *tag()
+		{
+			return user;
+		}
+		void write(char const *, std::size_t size)
+		{
+			bytes += size;
+			if(corked)
+			{
+				held += size;
+				return;
+			}
+			send(size);
+		}
+		void cork()
+		{
+			corked = true;
+		}
+		void uncork()
+		{
+			corked = false;
+			if(held != 0)
+			{
+				send(held), held = 0;
+			}
+		}
+		void close()
+		{
+			closed = true;
+		}
+		std::size_t queued()
+		{
+			return 0;
+		}
+
+	private:
+		void send(std::size_t size)
+		{
+			++sends;
+			packets += (size + MSS - 1)/MSS;
+		}
+	};
+	using server_client = _server_client *;
+
+	struct _server;
+	using server = _server *;
+	struct _server final
+	{
+		void *user = nullptr;
+
+		void tag(void *t)
+		{
+			user = t;
+		}
+		void *tag()
+		{
+			return user;
+		}
+		void on_connect(void (*)(server, server_client))
+		{
+		}
+		void on_disconnect(void (*)(server, server_client))
+		{
+		}
+		void on_data(void (*)(server, server_client, char const *, std::size_t))
+		{
+		}
+		void on_error(void (*)(server, error))
+		{
+		}
+		void unhost()
+		{
+		}
+	};
+	inline server server_new(pump)
+	{
+		return new _server;
+	}
+	inline void server_delete(server s)
+	{
+		delete s;
+	}
+
+	struct _udp final
+	{
+		void unhost()
+		{
+		}
+		void send(address, char const *, std::size_t)
+		{
+		}
+	};
+	using udp = _udp *;
+	inline udp udp_new(pump)
+	{
+		return new _udp;
+	}
+	inline void udp_delete(udp u)
+	{
+		delete u;
+	}
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include <Relay.hpp>
+#include "../src/IDs.hpp"
+#include "../src/Names.hpp"
+#include "../src/Frames.hpp"
+#include "../src/Memory.hpp"
+#include "../src/Compression.hpp"
+#include "Harness.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Times the data structures the relay is built on, in isolation from the
+//network, and writes the results as JSON so each primitive can be tracked
+//on its own. Every benchmark is run at each size up to the 65535-ID limit,
+//except compression, which is timed on sample payloads of each size.
+//relay-server-bench covers the server as a whole.
+//Usage: relay-microbench [output.json]
+namespace
+{
+	using namespace lwrelay;
+
+	std::size_t const SIZES[] = {16, 256, 4096, 65535};
+
+	//Defeats dead code elimination of benchmarked results
+	std::uintptr_t volatile sink;
+
+	//Shuffled keys in [0, n), so lookups don't walk memory in order
+	std::vector<ID_t> keys(std::size_t n)
+	{
+		std::vector<ID_t> ret (n);
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			ret[i] = static_cast<ID_t>(i);
+		}
+		std::shuffle(ret.begin(), ret.end(), std::mt19937(static_cast<std::mt19937::result_type>(n)));
+		return ret;
+	}
+
+	struct Main : Harness
+	{
+		//Releases and regenerates IDs with n in use, which is what connects
+		//and disconnects do to the server's IdManager
+		void IdChurn(std::size_t n)
+		{
+			IdManager<ID_t> ids;
+			std::vector<ID_t> held;
+			for(std::size_t i = 0; i < n; ++i)
+			{
+				held.push_back(ids.generate());
+			}
+			std::vector<ID_t> const order = keys(n);
+			Run("ids/churn", n, [&](std::uint64_t i)
+			{
+				ID_t &slot = held[order[i % n]];
+				ids.release(slot);
+				slot = ids.generate();
+			});
+			Run("ids/holder", n, [&](std::uint64_t)
+			{
+				//The last ID is free, since only n of 65536 are in use
+				IdHolder<ID_t> holder (ids);
+				sink = holder;
+			});
+		}
+
+		//Finds clients and channels by ID, as Server::Impl::clients and channels do
+		void Lookup(std::size_t n)
+		{
+			struct Entity final
+			{
+				ID_t id;
+			};
+			memory::Map_t<ID_t, std::unique_ptr<Entity>> entities;
+			for(ID_t id : keys(n))
+			{
+				entities.emplace(id, std::unique_ptr<Entity>(new Entity{id}));
+			}
+			std::vector<ID_t> const order = keys(n);
+			Run("server/lookup", n, [&](std::uint64_t i)
+			{
+				sink = entities.find(order[i % n])->second->id;
+			});
+		}
+
+		//Removes and re-adds members of a channel with n members, as
+		//Channel::Impl::clients does when clients join and leave
+		void Membership(std::size_t n)
+		{
+			int member;
+			memory::Map_t<ID_t, int *> clients;
+			for(ID_t id : keys(n))
+			{
+				clients.emplace(id, &member);
+			}
+			std::vector<ID_t> const order = keys(n);
+			Run("channel/membership", n, [&](std::uint64_t i)
+			{
+				ID_t const id = order[i % n];
+				clients.erase(id);
+				clients.emplace(id, &member);
+			});
+		}
+
+		//Looks channel names up among n interned names, as joining a channel by name does
+		void NameLookup(std::size_t n)
+		{
+			NameTable table;
+			std::vector<Name> channels;
+			std::vector<std::string> strings;
+			for(std::size_t i = 0; i < n; ++i)
+			{
+				strings.push_back("Channel #" + std::to_string(i));
+				channels.emplace_back(table, strings.back());
+			}
+			std::vector<ID_t> const order = keys(n);
+			Run("names/lookup", n, [&](std::uint64_t i)
+			{
+				std::size_t const which = order[i % n];
+				sink = (Name(table, strings[which]) == channels[which]);
+			});
+		}
+
+		//Encodes channel messages with an n-byte payload, both as the relay does
+		//and through a generic std::ostringstream encoder for comparison, and
+		//decodes the headers of a run of them
+		void Frames(std::size_t n)
+		{
+			std::string const payload (n, 'x');
+			Run("frames/encode", n, [&](std::uint64_t i)
+			{
+				frames::Frame_t const frame = frames::ChannelMessage::frame(memory::defaultResource(), 0, static_cast<Subchannel_t>(i), {{1, 2}}, payload);
+				sink = frame->size();
+			});
+			Run("frames/encode-stringstream", n, [&](std::uint64_t i)
+			{
+				auto const put16 = [](std::ostream &out, std::uint16_t v){ out.put(static_cast<char>(v & 0xFF)).put(static_cast<char>(v >> 8)); };
+				std::ostringstream out;
+				std::size_t const size = 5 + payload.size();
+				out.put(static_cast<char>(static_cast<std::uint8_t>(frames::ToClient::BinaryChannelMessage) << 4));
+				if(size < 254)
+				{
+					out.put(static_cast<char>(size));
+				}
+				else if(size < 0xFFFF)
+				{
+					out.put(static_cast<char>(254));
+					put16(out, static_cast<std::uint16_t>(size));
+				}
+				else
+				{
+					out.put(static_cast<char>(255));
+					put16(out, static_cast<std::uint16_t>(size & 0xFFFF));
+					put16(out, static_cast<std::uint16_t>(size >> 16));
+				}
+				out.put(static_cast<char>(i));
+				put16(out, 1);
+				put16(out, 2);
+				out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+				sink = out.str().size();
+			});
+
+			std::string stream;
+			for(std::size_t i = 0; i < 64; ++i)
+			{
+				frames::Frame_t const frame = frames::ChannelMessage::frame(memory::defaultResource(), 0, static_cast<Subchannel_t>(i), {{1, 2}}, payload);
+				stream.append(frame->data(), frame->size());
+			}
+			std::size_t offset = 0;
+			Run("frames/decode", n, [&](std::uint64_t)
+			{
+				std::uint8_t type;
+				Variant_t variant;
+				Size_t size;
+				std::size_t const header = frames::readHeader(stream.data() + offset, stream.size() - offset, type, variant, size);
+				offset += header + size;
+				offset = (offset < stream.size()) ? offset : 0;
+				sink = type;
+			});
+		}
+
+		//Deflates and inflates an n-byte payload of repetitive JSON, like the
+		//state updates compressed subchannels are meant for, with and without a
+		//preset dictionary, reporting the bytes saved alongside the CPU time
+		void Compression(std::size_t n)
+		{
+			std::string const dictionary = "{\"id\":,\"name\":\"player\",\"x\":,\"y\":,\"health\":,\"state\":\"idle\"}";
+			std::string payload;
+			for(std::size_t i = 0; payload.size() < n; ++i)
+			{
+				payload += "{\"id\":" + std::to_string(i) + ",\"name\":\"player\",\"x\":" + std::to_string(i*7 % 640)
+				         + ",\"y\":" + std::to_string(i*13 % 480) + ",\"health\":100,\"state\":\"idle\"}";
+			}
+			payload.resize(n);
+			for(bool const preset : {false, true})
+			{
+				Compressor compressor;
+				Decompressor decompressor;
+				if(preset)
+				{
+					compressor.dictionary(dictionary);
+					decompressor.dictionary(dictionary);
+				}
+				std::string const packed = compressor.compress(payload);
+				std::vector<std::pair<char const *, double>> const counters = {{"bytes_in", double(n)}, {"bytes_out", double(packed.size())}};
+				Run(preset ? "compression/deflate+dictionary" : "compression/deflate", n, [&](std::uint64_t)
+				{
+					sink = compressor.compress(payload).size();
+				});
+				Results.back().counters = counters;
+				std::string inflated;
+				Run(preset ? "compression/inflate+dictionary" : "compression/inflate", n, [&](std::uint64_t)
+				{
+					sink = decompressor.decompress(packed.data(), packed.size(), inflated, n);
+				});
+				Results.back().counters = counters;
+			}
+		}
+
+		//Calls a handler through std::function the way the server calls user handlers
+		void Dispatch(Server &server)
+		{
+			Server::Clients_t clients;
+			Server::Channels_t channels;
+			Server::Clients_t::iterator client = clients.end();
+			Server::Channels_t::iterator channel = channels.end();
+			std::function<Server::ChannelMessageHandler> handler = [](Server &, Server::Clients_t::iterator &, Server::Channels_t::iterator &, Protocol &, Subchannel_t &subchannel, Variant_t &, std::string &data)
+			{
+				sink = subchannel + data.size();
+				return Server::Deny(true);
+			};
+			std::string data = "payload";
+			Run("handlers/dispatch", 1, [&](std::uint64_t i)
+			{
+				Protocol protocol = Protocol::TCP;
+				Subchannel_t subchannel = static_cast<Subchannel_t>(i);
+				Variant_t variant = 0;
+				handler(server, client, channel, protocol, subchannel, variant, data);
+			});
+		}
+	};
+}
+
+int main(int nargs, char const *const *args)
+{
+	Main m;
+	for(std::size_t n : SIZES)
+	{
+		m.IdChurn(n);
+		m.Lookup(n);
+		m.Membership(n);
+		m.NameLookup(n);
+		m.Frames(n);
+		m.Compression(n);
+	}
+	lacewing::eventpump pump = lacewing::eventpump_new();
+	{
+		Server server (pump);
+		m.Dispatch(server);
+	}
+	lacewing::pump_delete(pump), pump = nullptr;
+	m.Write(nargs, args);
+}
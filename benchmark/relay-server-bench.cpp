@@ -0,0 +1,180 @@
+//The server's classes are private to its translation unit, so it is compiled
+//into this one, against the counting stand-in for lacewing.h:
+//  c++ -std=c++11 -Ibenchmark/counting-lacewing -Iinclude benchmark/relay-server-bench.cpp -lz
+//Relay.hpp only befriends ServerProbe when it is asked to.
+#define LWRELAY_SERVER_PROBE
+#include "../src/RelayServer.cpp"
+#include "Harness.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lwrelay
+{
+	//Does what the protocol would, had the server parsed it yet
+	struct ServerProbe final
+	{
+		//Connects a relay client on the given connection
+		static void connect(Server &server, lacewing::server_client connection)
+		{
+			lacewing::server const s = server.impl->server;
+			Server::Impl::lwConnect(s, connection);
+			char const hello = 0;
+			Server::Impl::lwData(s, connection, &hello, 1);
+		}
+		//Reports the connection closed by the remote end
+		static void disconnect(Server &server, lacewing::server_client connection)
+		{
+			Server::Impl::lwDisconnect(server.impl->server, connection);
+		}
+		//Creates a channel whose members are the clients on the given connections
+		static Server::Channel &channel(Server &server, std::string const &name, std::vector<std::unique_ptr<lacewing::_server_client>> const &members)
+		{
+			Server::Impl &s = *server.impl;
+			std::unique_ptr<Server::Channel> channel (new Server::Channel(new Server::Channel::Impl(s, name, Server::Clients_t::iterator(), false, true)));
+			Server::Channel::Impl &ci = *channel->impl;
+			for(auto const &connection : members)
+			{
+				Server::Client &client = *static_cast<Server::Client *>(connection->tag());
+				ci.clients.emplace(client.ID(), &client);
+				client.impl->channels.insert(ci.id, channel.get());
+			}
+			ci.invalidate();
+			ID_t const id = ci.id;
+			return *s.channels.emplace(id, std::move(channel)).first->second;
+		}
+		//Ends the channel's current tick, as its timer would
+		static void tick(Server::Channel &channel)
+		{
+			Server::Channel::Impl::lwTick(channel.impl->tick_timer);
+		}
+	};
+}
+
+//Drives a whole Server, with no network, and writes the results as JSON.
+//Usage: relay-server-bench [output.json]
+namespace
+{
+	using namespace lwrelay;
+	using Connections_t = std::vector<std::unique_ptr<lacewing::_server_client>>;
+
+	Connections_t connect(Server &server, std::size_t n)
+	{
+		Connections_t connections;
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			connections.emplace_back(new lacewing::_server_client);
+			ServerProbe::connect(server, connections.back().get());
+		}
+		return connections;
+	}
+
+	struct Main : Harness
+	{
+		lacewing::pump pump = lacewing::eventpump_new();
+		~Main()
+		{
+			lacewing::pump_delete(pump), pump = nullptr;
+		}
+
+		//Sends a second of channel traffic, 8 messages in each 16 ms tick, to a
+		//channel of n members through Channel::send, counting the sends and
+		//packets the members' connections make. Relayed immediately, the
+		//messages of a tick are compared arriving in one pump iteration each
+		//and all in the same one; in tick mode, each tick is delivered as one
+		//batch.
+		void Ticks(std::size_t n)
+		{
+			std::size_t const TICKS = 60, MESSAGES = 8;
+			std::string const payload (48, 'x');
+			Server server (pump);
+			Connections_t const members = connect(server, n);
+			Server::Channel &channel = ServerProbe::channel(server, "ticks", members);
+			auto const second = [&](std::size_t per_iteration)
+			{
+				for(auto const &c : members)
+				{
+					c->sends = c->packets = 0;
+				}
+				for(std::size_t i = 0; i < TICKS*MESSAGES; ++i)
+				{
+					channel.send(Protocol::TCP, static_cast<Subchannel_t>(i % MESSAGES), 0, payload);
+					if((i + 1) % per_iteration == 0)
+					{
+						if(channel.tickInterval() != 0)
+						{
+							ServerProbe::tick(channel);
+						}
+						pump->run();
+					}
+				}
+			};
+			auto const counters = [&]
+			{
+				std::uint64_t sends = 0, packets = 0;
+				for(auto const &c : members)
+				{
+					sends += c->sends, packets += c->packets;
+				}
+				Results.back().counters = {{"syscalls_per_second", double(sends)}, {"packets_per_second", double(packets)}};
+			};
+
+			Run("tick/immediate", n, [&](std::uint64_t){ second(1); });
+			counters();
+			Run("tick/immediate-burst", n, [&](std::uint64_t){ second(MESSAGES); });
+			counters();
+			channel.tickInterval(16);
+			Run("tick/aggregated", n, [&](std::uint64_t){ second(MESSAGES); });
+			counters();
+			server.unhost(); //while the connections it closes still exist
+		}
+		//Tears down n clients, all members of one channel, each way it can
+		//happen at once: unhosting the server, closing the channel, and every
+		//client disconnecting. Each run starts from a freshly populated server.
+		void Teardown(std::size_t n)
+		{
+			Server server (pump);
+			Connections_t connections;
+			Server::Channel *channel = nullptr;
+			auto const setup = [&]
+			{
+				server.unhost(); //what is left of the last run, before its connections go
+				pump->run();
+				connections = connect(server, n);
+				channel = &ServerProbe::channel(server, "teardown", connections);
+			};
+
+			RunEach("teardown/unhost", n, setup, [&]{ server.unhost(); });
+			RunEach("teardown/channel-close", n, setup, [&]
+			{
+				channel->close();
+				pump->run();
+			});
+			RunEach("teardown/disconnect-all", n, setup, [&]
+			{
+				for(auto const &c : connections)
+				{
+					ServerProbe::disconnect(server, c.get());
+				}
+				pump->run();
+			});
+			server.unhost();
+		}
+	};
+}
+
+int main(int nargs, char const *const *args)
+{
+	Main m;
+	for(std::size_t n : {64, 128, 256, 512})
+	{
+		m.Ticks(n);
+	}
+	for(std::size_t n : {16, 256, 4096})
+	{
+		m.Teardown(n);
+	}
+	m.Write(nargs, args);
+}
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+//Keep console window open at end of application until user presses enter key
+struct KR{~KR()
+{
+	std::cin.sync();
+	std::cout << std::endl << "End of application, press Enter..." << std::flush;
+	std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+}}kr;
+
+#include <lacewing.h>
+#include "../src/Capture.hpp"
+
+//Replays a capture made with lwrelay::Server::startRecording against a server,
+//opening one connection per recorded client and sending exactly the recorded
+//data at the recorded times, optionally sped up.
+//Usage: example-relay-replay <capture> [host] [port] [speed]
+struct Main
+{
+	lacewing::eventpump Pump;
+	lacewing::timer Timer;
+	std::vector<char> Log;
+	std::size_t Next = sizeof(CAPTURE_MAGIC) - 1;
+	std::string Host = "localhost";
+	long Port = 6121;
+	double Speed = 1.0;
+	std::map<std::uint16_t, lacewing::client> Clients;
+	std::chrono::steady_clock::time_point Start;
+
+	Main(unsigned nargs, char const *const *args) : Pump(lacewing::eventpump_new()), Timer(lacewing::timer_new(Pump))
+	{
+		if(nargs > 1)
+		{
+			std::ifstream file (args[1], std::ios::binary);
+			Log.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+		if(nargs > 2) Host = args[2];
+		if(nargs > 3) Port = std::strtol(args[3], nullptr, 10);
+		if(nargs > 4) Speed = std::strtod(args[4], nullptr);
+		Timer->tag(static_cast<void *>(this));
+		Timer->on_tick(OnTick);
+	}
+	~Main()
+	{
+		for(auto &c : Clients)
+		{
+			lacewing::client_delete(c.second), c.second = nullptr;
+		}
+		lacewing::timer_delete(Timer), Timer = nullptr;
+		lacewing::pump_delete(Pump), Pump = nullptr;
+	}
+
+	int Go()
+	{
+		if(Log.size() < Next || std::memcmp(Log.data(), CAPTURE_MAGIC, Next) != 0 || !(Speed > 0.0))
+		{
+			std::cerr << "Usage: example-relay-replay <capture> [host] [port] [speed]" << std::endl;
+			return -1;
+		}
+		std::clog << "Replaying to " << Host << ':' << Port << " at " << Speed << "x speed" << std::endl;
+
+		Start = std::chrono::steady_clock::now();
+		Timer->start(1);
+		lacewing::error e = Pump->start_eventloop();
+		if(e)
+		{
+			std::cerr << e->tostring() << std::endl;
+			lacewing::error_delete(e), e = nullptr;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	void Dispatch(CaptureRecord const &r, char const *data)
+	{
+		auto it = Clients.find(r.client);
+		switch(r.kind)
+		{
+			case CaptureRecord::Connect:
+			{
+				if(it != Clients.end())
+				{
+					lacewing::client_delete(it->second), it->second = nullptr;
+				}
+				lacewing::client c = lacewing::client_new(Pump);
+				c->connect(Host.c_str(), Port);
+				Clients[r.client] = c;
+			} break;
+			case CaptureRecord::Data:
+			{
+				if(it != Clients.end())
+				{
+					it->second->write(data, r.size);
+				}
+			} break;
+			case CaptureRecord::Disconnect:
+			{
+				if(it != Clients.end())
+				{
+					lacewing::client_delete(it->second), it->second = nullptr;
+					Clients.erase(it);
+				}
+			} break;
+		}
+	}
+
+	static void (lw_callback OnTick)(lacewing::timer Timer)
+	{
+		Main &m = *static_cast<Main *>(Timer->tag());
+		double const elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m.Start).count() * m.Speed;
+		while(m.Next + sizeof(CaptureRecord) <= m.Log.size())
+		{
+			CaptureRecord r;
+			std::memcpy(&r, m.Log.data() + m.Next, sizeof(r));
+			if(CaptureRecord::padded(r.size) > m.Log.size() - m.Next - sizeof(r))
+			{
+				//The server stopped before writing the rest, which is normal if it crashed
+				std::clog << "Capture is truncated; replaying what was recorded" << std::endl;
+				break;
+			}
+			if(static_cast<double>(r.time) > elapsed)
+			{
+				return;
+			}
+			m.Dispatch(r, m.Log.data() + m.Next + sizeof(r));
+			m.Next += sizeof(r) + CaptureRecord::padded(r.size);
+		}
+		std::clog << "Replay complete" << std::endl;
+		Timer->stop();
+		m.Pump->post_eventloop_exit();
+	}
+};
+
+int main(/*un*/signed nargs, char const *const *args)
+{
+	return Main(static_cast<unsigned>(nargs), args).Go();
+}
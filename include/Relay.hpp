@@ -9,6 +9,16 @@
 #include <string>
 #include <functional>
 
+//Define LWRELAY_PMR when building the library, and for everything that uses
+//it, to let servers and clients take a std::pmr::memory_resource (C++17).
+//It must be the same everywhere, since it changes the classes' members.
+#ifdef LWRELAY_PMR
+#if __cplusplus < 201703L
+#error LWRELAY_PMR requires C++17
+#endif
+#include <memory_resource>
+#endif
+
 namespace lwrelay
 {
 	/**
@@ -42,6 +52,12 @@ namespace lwrelay
 		UDP
 	};
 
+#ifdef LWRELAY_SERVER_PROBE
+	//Defined by relay-server-bench before it compiles the server in, so the
+	//benchmark can reach the internals; never defined by an installed build
+	struct ServerProbe;
+#endif
+
 	/**
 	 * Implements a Lacewing Relay Server based on the latest protocol draft.
 	 * https://github.com/udp/lacewing/blob/0.2.x/relay/current_spec.txt
@@ -50,12 +66,30 @@ namespace lwrelay
 	{
 		void *tag = nullptr;
 
+		/**
+		 * Supplies the payload of a streamed message in chunks.
+		 * Copy up to size bytes into the buffer and return how many were
+		 * copied. Returning 0 means no data is available yet; the reader
+		 * will be called again later until the whole payload is supplied.
+		 */
+		using StreamReader = std::size_t (char *buffer, std::size_t size);
+
 		/**
 		 * Construct a new server from a pump, such as an event pump.
 		 * The given pump must remain valid until after the destructor has
 		 * been called.
 		 */
 		Server(lacewing::pump pump);
+#ifdef LWRELAY_PMR
+		/**
+		 * Construct a new server from a pump whose internal allocations
+		 * all come from the given memory resource, such as a per-thread
+		 * pool. The resource must outlive the server. The exception is the
+		 * small handle posted to the pump to defer each flush, which can
+		 * outlive the server and so uses the global allocator.
+		 */
+		Server(lacewing::pump pump, std::pmr::memory_resource *resource);
+#endif
 		/**
 		 * Destructs this server.
 		 */
@@ -64,6 +98,7 @@ namespace lwrelay
 		Server(Server &&) = default;
 		Server &operator=(Server &&) noexcept;
 
+		struct Channel;
 		/**
 		 * Represents a client connected to this server.
 		 * Each client can be in multiple channels, and
@@ -84,7 +119,9 @@ namespace lwrelay
 			Client &operator=(Client &&) noexcept;
 
 			/**
-			 * Returns true if this client is an HTTP client.
+			 * Returns true if this client is an HTTP client, such as a
+			 * browser, which talks to the server over a WebSocket on
+			 * the same port as everyone else.
 			 */
 			bool isHTTP() const noexcept;
 			/**
@@ -114,10 +151,52 @@ namespace lwrelay
 			 * Returns true if this client has indicated that they can use UDP/blasting.
 			 */
 			bool usingUDP() const noexcept;
+			/**
+			 * Returns true if this client has agreed to receive compressed payloads.
+			 */
+			bool compression() const noexcept;
+			/**
+			 * Sets whether this client has agreed to receive compressed payloads on
+			 * the subchannels enabled with Server::setCompression, e.g. once the
+			 * client has negotiated compression when connecting.
+			 */
+			void compression(bool enabled);
+			/**
+			 * Returns the token this client can present after reconnecting to
+			 * resume its session, or an empty string if sessions are not resumable.
+			 * The token changes every time the session is resumed.
+			 */
+			std::string const &sessionToken() const noexcept;
+			/**
+			 * Resumes the suspended session with the given token on this client's
+			 * connection, given how many bytes the client had received on its old
+			 * connection (see lwrelay::Client::received). The session's ID, name
+			 * and channels are restored, and every frame the client did not
+			 * receive is sent, both those lost in flight when the connection
+			 * dropped and those sent since. On success, this client ceases to
+			 * exist and must not be used again; its handlers should return
+			 * immediately. Returns false if there is no suspended session with
+			 * the token, or if frames lost in flight are no longer held, in
+			 * which case the session is dropped.
+			 */
+			bool resume(std::string const &token, std::uint64_t received);
+			/**
+			 * Returns an estimate of the memory this client uses in the server,
+			 * in bytes, counting its queues but not the frames waiting in them,
+			 * which may be shared with other clients. Names are
+			 * shared, so each client is charged its share of its name.
+			 */
+			std::size_t footprint() const noexcept;
 			/**
 			 * Sends a server message to this client with the given data.
 			 */
 			void send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data);
+			/**
+			 * Sends a server message of the given size to this client over TCP,
+			 * pulling the data from the reader in chunks as the connection drains
+			 * instead of holding the whole payload in memory.
+			 */
+			void stream(Subchannel_t subchannel, Variant_t variant, Size_t size, std::function<StreamReader> reader);
 
 		private:
 			struct Impl;
@@ -130,6 +209,9 @@ namespace lwrelay
 
 			friend struct ::lwrelay::Server::Channel;
 			friend struct ::lwrelay::Server;
+#ifdef LWRELAY_SERVER_PROBE
+			friend struct ::lwrelay::ServerProbe;
+#endif
 		};
 		using Clients_t = std::map<ID_t, std::reference_wrapper<Client>>;
 
@@ -191,6 +273,28 @@ namespace lwrelay
 			 * Sends a server channel message to this channel with the given data.
 			 */
 			void send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data);
+			/**
+			 * Sends a server channel message of the given size to this channel over
+			 * TCP, pulling the data from the reader in chunks. Each chunk is read
+			 * once and shared by every member, and the reader is never asked to
+			 * run far ahead of the slowest member. A member that holds the others
+			 * up for more than a few seconds is dropped from the stream and
+			 * disconnected, since it can no longer receive the message.
+			 */
+			void stream(Subchannel_t subchannel, Variant_t variant, Size_t size, std::function<StreamReader> reader);
+			/**
+			 * Returns the tick interval in milliseconds, or 0 if messages sent
+			 * to this channel are relayed immediately.
+			 */
+			std::uint32_t tickInterval() const noexcept;
+			/**
+			 * Sets the interval in milliseconds at which messages sent to this
+			 * channel are delivered, or 0 (the default) to relay them immediately.
+			 * In tick mode every message sent during a tick is held until the tick
+			 * ends, and then each member gets all of them, in order, in one write.
+			 * Each message is still built once and shared by every member.
+			 */
+			void tickInterval(std::uint32_t tick_ms);
 			/**
 			 * Returns the channel master, or null if there is no channel master.
 			 */
@@ -201,6 +305,19 @@ namespace lwrelay
 			 * the channel is set to auto close when the channel master leaves.
 			 */
 			void channelMaster(Clients_t::iterator member);
+			/**
+			 * Returns true if the given member receives messages sent to this
+			 * channel on the given subchannel. Members are subscribed to every
+			 * subchannel when they join.
+			 */
+			bool subscribed(Clients_t::iterator member, Subchannel_t subchannel) const;
+			/**
+			 * Subscribes or unsubscribes the given member to messages sent to this
+			 * channel on the given subchannel, unless the given client is not in
+			 * the channel. Unsubscribed members are left out of the recipient
+			 * lists built for each subchannel, so they cost nothing when relaying.
+			 */
+			void subscribe(Clients_t::iterator member, Subchannel_t subchannel, bool subscribed);
 
 		private:
 			struct Impl;
@@ -213,6 +330,9 @@ namespace lwrelay
 
 			friend struct ::lwrelay::Server::Client;
 			friend struct ::lwrelay::Server;
+#ifdef LWRELAY_SERVER_PROBE
+			friend struct ::lwrelay::ServerProbe;
+#endif
 		};
 		using Channels_t = std::map<ID_t, std::reference_wrapper<Channel>>;
 
@@ -224,10 +344,51 @@ namespace lwrelay
 		 * Set the 'welcome message' sent to clients on connect.
 		 */
 		void setWelcomeMessage(std::string const &message);
+		/**
+		 * Assign messages sent on the given protocol and subchannel to a priority
+		 * class, from 0 (most urgent) to 3 (bulk). Queued frames of more urgent
+		 * classes are written first, overtaking queued bulk frames at frame
+		 * boundaries, while each class keeps a weighted share (8:4:2:1) of every
+		 * write so bulk transfers are never starved. By default every subchannel
+		 * is in class 0, which keeps all messages to a client in order.
+		 */
+		void setPriority(Protocol protocol, Subchannel_t subchannel, std::uint8_t priority);
+		/**
+		 * Enable or disable compression of payloads sent on the given subchannel.
+		 * Payloads are raw deflate streams and are only compressed for clients
+		 * that have agreed to compression; streamed messages are never compressed.
+		 * A channel message is compressed once and shared by all its recipients.
+		 * Compressed payloads are marked by setting the top bit of the variant,
+		 * so compressed subchannels only carry variants 0 to 7; sending a
+		 * higher variant on one throws std::invalid_argument.
+		 * See Client::setCompression.
+		 */
+		void setCompression(Subchannel_t subchannel, bool enabled);
+		/**
+		 * Set the preset deflate dictionary shared with clients, which lets small,
+		 * repetitive payloads such as JSON compress well. Clients must use the
+		 * same dictionary to decompress.
+		 */
+		void setCompressionDictionary(std::string const &dictionary);
+		/**
+		 * Enable resumable sessions by holding on to a disconnected client for
+		 * grace_ms milliseconds instead of destroying it, or disable them with 0.
+		 * A held client keeps its ID, name and channels, and peers are not told it
+		 * left. Frames sent to it meanwhile are kept, up to buffer_size bytes, and
+		 * sent once it resumes; if they do not fit, the session is dropped. The
+		 * last buffer_size bytes written to each client are kept as well, to
+		 * send again those lost in flight when its connection drops.
+		 * Streamed messages are not kept, since they would hold up the other
+		 * members of the channel until the session resumed.
+		 * See Client::sessionToken and Client::resume.
+		 */
+		void setSessionResumption(std::uint32_t grace_ms, std::size_t buffer_size = 64*1024);
 		/**
 		 * Begin hosting this server on the given port, default 6121.
 		 * This function fails if the server is already hosting or if
 		 * one of the internal lacewing server fails to begin hosting.
+		 * Once every client ID is in use, new connections are refused
+		 * and reported to the error handler.
 		 */
 		void host(std::uint16_t port = 6121);
 		/**
@@ -248,6 +409,26 @@ namespace lwrelay
 		 * Returns the port the server is being hosted on, in case you forgot.
 		 */
 		std::uint16_t port() const noexcept;
+		/**
+		 * Begin recording every connection, disconnection and inbound TCP frame,
+		 * with timestamps and client IDs, to a capture file at the given path,
+		 * replacing any recording in progress. The capture can be replayed
+		 * against a server with example-relay-replay. Failure to open the file
+		 * is reported to the error handler.
+		 */
+		void startRecording(std::string const &path);
+		/**
+		 * Stops recording and closes the capture file.
+		 */
+		void stopRecording();
+		/**
+		 * Writes the hot-path trace events of every thread that ended in the
+		 * last given number of seconds to a Chrome trace (JSON) file, which
+		 * can be opened in Perfetto or chrome://tracing. Events are only
+		 * recorded when the library is built with LWRELAY_TRACE defined.
+		 * Failure to write the file is reported to the error handler.
+		 */
+		void dumpTrace(std::string const &path, double seconds = 10.0);
 
 		/**
 		 * Represents an indication of or reason for denying a request.
@@ -310,6 +491,10 @@ namespace lwrelay
 		Server() = delete;
 		Server(Server const&) = delete;
 		Server &operator=(Server const&) = delete;
+
+#ifdef LWRELAY_SERVER_PROBE
+		friend struct ::lwrelay::ServerProbe;
+#endif
 	};
 
 	/**
@@ -326,6 +511,16 @@ namespace lwrelay
 		 * been called.
 		 */
 		Client(lacewing::pump pump);
+#ifdef LWRELAY_PMR
+		/**
+		 * Construct a new client from a pump whose internal allocations
+		 * all come from the given memory resource, such as a per-thread
+		 * pool. The resource must outlive the client. The exception is the
+		 * small handle posted to the pump to defer each flush, which can
+		 * outlive the client and so uses the global allocator.
+		 */
+		Client(lacewing::pump pump, std::pmr::memory_resource *resource);
+#endif
 		/**
 		 * Destructs this client.
 		 */
@@ -453,6 +648,13 @@ namespace lwrelay
 		 * Disconnects this client from the server.
 		 */
 		void disconnect();
+		/**
+		 * Returns how many bytes of messages this client has received on its
+		 * current connection. Once disconnected, and before reconnecting, keep
+		 * it to send along with the session token for Server::Client::resume,
+		 * which sends again whatever was lost in flight.
+		 */
+		std::uint64_t received() const noexcept;
 		/**
 		 * Returns the address of the server in case you forgot it.
 		 */
@@ -489,6 +691,32 @@ namespace lwrelay
 		 * Requests to join/create a channel with the given name.
 		 */
 		void join(std::string const &channel, bool autoclose = false, bool visible = true);
+		/**
+		 * Enable or disable batching of messages sent over TCP. While enabled,
+		 * messages are appended to a buffer that is written all at once when
+		 * flush is called, at the end of the current pump iteration, or as soon
+		 * as it holds at least threshold bytes, whichever comes first.
+		 * Disabling batching flushes the buffer.
+		 */
+		void setBatching(bool enabled, std::size_t threshold = 16*1024);
+		/**
+		 * Writes any batched messages to the server now.
+		 */
+		void flush();
+		/**
+		 * Enable or disable decompression of server messages and server channel
+		 * messages received on the given subchannel, to match the server's
+		 * Server::setCompression once this client has agreed to compression.
+		 * Handlers get the inflated payload, with the variant's compression bit
+		 * cleared; payloads that fail to inflate, or would inflate past the
+		 * largest message size, are reported as errors.
+		 */
+		void setCompression(Subchannel_t subchannel, bool enabled);
+		/**
+		 * Set the preset deflate dictionary, which must be the same as the
+		 * server's Server::setCompressionDictionary.
+		 */
+		void setCompressionDictionary(std::string const &dictionary);
 
 		/* Handler prototypes *
 		 * These are the handlers you can implement to customize
@@ -515,6 +743,14 @@ namespace lwrelay
 		using             PeerJoinHandler = void (Client &client, Channel &channel, Channel::Peer &peer);
 		using            PeerLeaveHandler = void (Client &client, Channel &channel, Channel::Peer &peer);
 		using       PeerChangeNameHandler = void (Client &client, Channel &channel, Channel::Peer &peer, std::string const &old_name);
+		/* Message handlers that are given a view of the payload where it was
+		 * received instead of a copy of it. The data is only valid until the
+		 * handler returns. If both kinds of handler are set, only these are called.
+		 */
+		using        ServerMessageViewHandler = void (Client &client,                                        Protocol protocol, Subchannel_t subchannel, Variant_t variant, char const *data, std::size_t size);
+		using ServerChannelMessageViewHandler = void (Client &client, Channel &channel,                      Protocol protocol, Subchannel_t subchannel, Variant_t variant, char const *data, std::size_t size);
+		using       ChannelMessageViewHandler = void (Client &client, Channel &channel, Channel::Peer &peer, Protocol protocol, Subchannel_t subchannel, Variant_t variant, char const *data, std::size_t size);
+		using          PeerMessageViewHandler = void (Client &client, Channel &channel, Channel::Peer &peer, Protocol protocol, Subchannel_t subchannel, Variant_t variant, char const *data, std::size_t size);
 
 		/* Handler setters *
 		 * Register your handlers by passing them to
@@ -540,6 +776,10 @@ namespace lwrelay
 		void onPeerJoin            (std::function<            PeerJoinHandler> handler); //Peer joined channel
 		void onPeerLeave           (std::function<           PeerLeaveHandler> handler); //Peer left channel
 		void onPeerChangeName      (std::function<      PeerChangeNameHandler> handler); //Peer changed name
+		void onServerMessage       (std::function<       ServerMessageViewHandler> handler); //Message from server, not copied
+		void onServerChannelMessage(std::function<ServerChannelMessageViewHandler> handler); //Message from server in channel, not copied
+		void onChannelMessage      (std::function<      ChannelMessageViewHandler> handler); //Message from channel, not copied
+		void onPeerMessage         (std::function<         PeerMessageViewHandler> handler); //Message from peer in channel, not copied
 
 	private:
 		struct Impl;
@@ -547,7 +787,7 @@ namespace lwrelay
 
 		Client() = delete;
 		Client(Client const&) = delete;
-		Client operator=(Client const&) = delete;
+		Client &operator=(Client const&) = delete;
 	};
 }
 
@@ -0,0 +1,95 @@
+#ifndef TrafficCapture_HeaderPlusPlus
+#define TrafficCapture_HeaderPlusPlus
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+//Append-only log of inbound traffic, as replayed by example-relay-replay.
+//The file is CAPTURE_MAGIC followed by records, each a CaptureRecord and its
+//data padded to a multiple of 8 bytes, all in host byte order, so a log can
+//be memory-mapped and walked record by record without any parsing.
+struct CaptureRecord final
+{
+	enum Kind : std::uint16_t
+	{
+		Connect,
+		Data,
+		Disconnect
+	};
+	std::uint64_t time; //nanoseconds since recording began
+	std::uint16_t client;
+	std::uint16_t kind;
+	std::uint32_t size;
+
+	static std::size_t padded(std::size_t size) noexcept
+	{
+		return (size + 7) & ~std::size_t(7);
+	}
+};
+static_assert(sizeof(CaptureRecord) == 16, "CaptureRecord must have no padding");
+constexpr char CAPTURE_MAGIC[] = "LWRCAP01";
+
+//Writes go through a large stdio buffer, so recording a frame costs a clock
+//read and a copy until the buffer fills.
+struct Recorder final
+{
+	static constexpr std::size_t BUFFER_SIZE = 1024*1024;
+
+	~Recorder()
+	{
+		close();
+	}
+
+	bool open(std::string const &path)
+	{
+		close();
+		file = std::fopen(path.c_str(), "wb");
+		if(!file)
+		{
+			return false;
+		}
+		buffer.reset(new char[BUFFER_SIZE]);
+		std::setvbuf(file, buffer.get(), _IOFBF, BUFFER_SIZE);
+		std::fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC) - 1, file);
+		start = std::chrono::steady_clock::now();
+		return true;
+	}
+	void close()
+	{
+		if(file)
+		{
+			std::fclose(file), file = nullptr;
+		}
+		buffer.reset();
+	}
+	bool recording() const noexcept
+	{
+		return file != nullptr;
+	}
+	void record(std::uint16_t client, CaptureRecord::Kind kind, char const *data = nullptr, std::size_t size = 0)
+	{
+		static char const zeroes[8] = {};
+		CaptureRecord const r
+		{
+			static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()),
+			client,
+			kind,
+			static_cast<std::uint32_t>(size)
+		};
+		std::fwrite(&r, sizeof(r), 1, file);
+		if(size != 0)
+		{
+			std::fwrite(data, 1, size, file);
+			std::fwrite(zeroes, 1, CaptureRecord::padded(size) - size, file);
+		}
+	}
+
+private:
+	std::FILE *file = nullptr;
+	std::unique_ptr<char[]> buffer;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
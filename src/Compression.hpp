@@ -0,0 +1,112 @@
+#ifndef PayloadCompression_HeaderPlusPlus
+#define PayloadCompression_HeaderPlusPlus
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <string>
+
+//Raw deflate with an optional preset dictionary. Every payload is compressed
+//independently, so one compressed payload can be shared by all recipients,
+//while the dictionary lets even small, repetitive payloads compress well.
+//The deflate context is reset rather than reallocated between payloads.
+struct Compressor final
+{
+	Compressor()
+	{
+		if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	~Compressor()
+	{
+		deflateEnd(&z);
+	}
+	Compressor(Compressor const &) = delete;
+	Compressor &operator=(Compressor const &) = delete;
+
+	void dictionary(std::string const &d)
+	{
+		dict = d;
+	}
+	std::string compress(std::string const &data)
+	{
+		deflateReset(&z);
+		if(!dict.empty())
+		{
+			deflateSetDictionary(&z, reinterpret_cast<Bytef const *>(dict.data()), static_cast<uInt>(dict.size()));
+		}
+		std::string out (deflateBound(&z, static_cast<uLong>(data.size())), '\0');
+		z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+		z.avail_in = static_cast<uInt>(data.size());
+		z.next_out = reinterpret_cast<Bytef *>(&out[0]);
+		z.avail_out = static_cast<uInt>(out.size());
+		deflate(&z, Z_FINISH);
+		out.resize(z.total_out);
+		return out;
+	}
+
+private:
+	z_stream z {};
+	std::string dict;
+};
+
+//The client's side of Compressor, which must be given the same dictionary.
+struct Decompressor final
+{
+	Decompressor()
+	{
+		if(inflateInit2(&z, -15) != Z_OK)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	~Decompressor()
+	{
+		inflateEnd(&z);
+	}
+	Decompressor(Decompressor const &) = delete;
+	Decompressor &operator=(Decompressor const &) = delete;
+
+	void dictionary(std::string const &d)
+	{
+		dict = d;
+	}
+	//Replaces out with the inflated payload, returning false if it is corrupt,
+	//incomplete, or would inflate to more than limit bytes
+	bool decompress(char const *data, std::size_t size, std::string &out, std::size_t limit)
+	{
+		inflateReset(&z);
+		if(!dict.empty())
+		{
+			inflateSetDictionary(&z, reinterpret_cast<Bytef const *>(dict.data()), static_cast<uInt>(dict.size()));
+		}
+		out.clear();
+		z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+		z.avail_in = static_cast<uInt>(size);
+		int result = Z_OK;
+		while(result == Z_OK)
+		{
+			std::size_t const have = out.size();
+			if(have > limit)
+			{
+				return false; //one byte past the limit is enough to know
+			}
+			std::size_t const room = std::min<std::size_t>({4*size + 256, limit + 1 - have, 1u << 30});
+			out.resize(have + room);
+			z.next_out = reinterpret_cast<Bytef *>(&out[have]);
+			z.avail_out = static_cast<uInt>(room);
+			result = inflate(&z, Z_NO_FLUSH);
+			out.resize(out.size() - z.avail_out);
+		}
+		return result == Z_STREAM_END && out.size() <= limit;
+	}
+
+private:
+	z_stream z {};
+	std::string dict;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef Fifo_HeaderPlusPlus
+#define Fifo_HeaderPlusPlus
+#include "Memory.hpp"
+
+#include <cstddef>
+#include <utility>
+
+//First-in first-out queue kept as a ring over a vector whose size is a power
+//of two. Unlike std::deque, it allocates nothing until the first push, which
+//matters for per-client queues that are empty most of the time.
+template<typename T>
+struct Fifo final
+{
+	Fifo(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: items(resource)
+	{
+	}
+
+	bool empty() const noexcept
+	{
+		return count == 0;
+	}
+	std::size_t size() const noexcept
+	{
+		return count;
+	}
+	//Bytes allocated for the ring, not counting anything its items own
+	std::size_t footprint() const noexcept
+	{
+		return items.capacity()*sizeof(T);
+	}
+
+	T &front() noexcept
+	{
+		return items[head];
+	}
+	T &operator[](std::size_t i) noexcept
+	{
+		return items[(head + i) & (items.size() - 1)];
+	}
+	void push_back(T item)
+	{
+		if(count == items.size())
+		{
+			grow();
+		}
+		(*this)[count++] = std::move(item);
+	}
+	void pop_front() noexcept
+	{
+		items[head] = T(); //let go of what the item holds now, not when it is overwritten
+		head = (head + 1) & (items.size() - 1);
+		--count;
+	}
+	void clear() noexcept
+	{
+		while(count != 0)
+		{
+			pop_front();
+		}
+	}
+	//Removes the items matching the predicate, keeping the others in order
+	template<typename Predicate>
+	void remove_if(Predicate &&remove)
+	{
+		std::size_t kept = 0;
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			if(!remove((*this)[i]))
+			{
+				if(kept != i)
+				{
+					(*this)[kept] = std::move((*this)[i]);
+				}
+				++kept;
+			}
+		}
+		for(std::size_t i = kept; i < count; ++i)
+		{
+			(*this)[i] = T();
+		}
+		count = kept;
+	}
+
+private:
+	lwrelay::memory::Vector_t<T> items;
+	std::size_t head = 0, count = 0;
+
+	void grow()
+	{
+		lwrelay::memory::Vector_t<T> bigger (items.get_allocator());
+		bigger.resize(items.empty() ? 4 : 2*items.size());
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			bigger[i] = std::move((*this)[i]);
+		}
+		items.swap(bigger);
+		head = 0;
+	}
+};
+
+#endif
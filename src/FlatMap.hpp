@@ -0,0 +1,76 @@
+#ifndef FlatMap_HeaderPlusPlus
+#define FlatMap_HeaderPlusPlus
+#include "Memory.hpp"
+
+#include <algorithm>
+#include <utility>
+
+//Map kept as a vector sorted by key. Lookups are a binary search over
+//contiguous memory; inserting and erasing move the entries after them,
+//which suits tables that are read far more often than they change.
+template<typename K, typename V>
+struct FlatMap final
+{
+	using value_type = std::pair<K, V>;
+	using iterator = typename lwrelay::memory::Vector_t<value_type>::iterator;
+
+	FlatMap(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: entries(resource)
+	{
+	}
+
+	iterator begin() noexcept
+	{
+		return entries.begin();
+	}
+	iterator end() noexcept
+	{
+		return entries.end();
+	}
+	std::size_t size() const noexcept
+	{
+		return entries.size();
+	}
+	bool empty() const noexcept
+	{
+		return entries.empty();
+	}
+
+	//Returns the value for the given key, or null if there is none
+	V *find(K const &key) noexcept
+	{
+		iterator it = lower(key);
+		return (it != entries.end() && it->first == key) ? &it->second : nullptr;
+	}
+	V &insert(K const &key, V value)
+	{
+		iterator it = lower(key);
+		if(it != entries.end() && it->first == key)
+		{
+			return it->second = std::move(value);
+		}
+		return entries.emplace(it, key, std::move(value))->second;
+	}
+	void erase(K const &key)
+	{
+		iterator it = lower(key);
+		if(it != entries.end() && it->first == key)
+		{
+			entries.erase(it);
+		}
+	}
+	void clear() noexcept
+	{
+		entries.clear();
+	}
+
+private:
+	lwrelay::memory::Vector_t<value_type> entries;
+
+	iterator lower(K const &key) noexcept
+	{
+		return std::lower_bound(entries.begin(), entries.end(), key, [](value_type const &e, K const &k){ return e.first < k; });
+	}
+};
+
+#endif
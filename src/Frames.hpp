@@ -0,0 +1,221 @@
+#ifndef FrameEncoding_HeaderPlusPlus
+#define FrameEncoding_HeaderPlusPlus
+#include "Memory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+
+namespace lwrelay
+{
+	namespace frames
+	{
+		//Frames are shared between the outbound queues of every recipient
+		using Frame_t = std::shared_ptr<memory::String_t const>;
+		inline Frame_t share(memory::Resource_t resource, memory::String_t frame)
+		{
+			return std::allocate_shared<memory::String_t>(memory::Allocator_t<memory::String_t>(resource), std::move(frame));
+		}
+
+		//Message types sent from the server to clients
+		enum struct ToClient : std::uint8_t
+		{
+			Response                   =  0,
+			BinaryServerMessage        =  1,
+			BinaryChannelMessage       =  2,
+			BinaryPeerMessage          =  3,
+			BinaryServerChannelMessage =  4,
+			Peer                       =  9,
+			UDPWelcome                 = 10,
+			Ping                       = 11
+		};
+
+		//Message types sent from clients to the server
+		enum struct ToServer : std::uint8_t
+		{
+			Request              = 0,
+			BinaryServerMessage  = 1,
+			BinaryChannelMessage = 2,
+			BinaryPeerMessage    = 3,
+			UDPHello             = 7,
+			ChannelMaster        = 8,
+			Pong                 = 9
+		};
+
+		//Request types, which responses refer to
+		enum struct Request : std::uint8_t
+		{
+			Connect      = 0,
+			SetName      = 1,
+			JoinChannel  = 2,
+			LeaveChannel = 3,
+			ChannelList  = 4
+		};
+
+		//Set in the variant of payloads the server deflated, which is why
+		//compressed subchannels only carry variants 0 to 7
+		constexpr Variant_t COMPRESSED = 0x8;
+
+		//The three forms of the size that follows the type/variant byte: a single
+		//byte, or a marker byte followed by a 16-bit or 32-bit size
+		struct SizeForm final
+		{
+			std::uint8_t length; //bytes including the marker
+			std::uint8_t marker;
+		};
+		constexpr SizeForm SIZE_FORMS[3] = {{1, 0}, {3, 254}, {5, 255}};
+		constexpr std::size_t sizeForm(Size_t size) noexcept
+		{
+			return (size < 254) ? 0 : (size < 0xFFFF) ? 1 : 2;
+		}
+		constexpr std::size_t MAX_HEADER = 1 + 5;
+
+		inline void store16(char *out, std::uint16_t v) noexcept
+		{
+			out[0] = static_cast<char>(v & 0xFF);
+			out[1] = static_cast<char>((v >> 8) & 0xFF);
+		}
+		inline void store32(char *out, std::uint32_t v) noexcept
+		{
+			store16(out, static_cast<std::uint16_t>(v & 0xFFFF));
+			store16(out + 2, static_cast<std::uint16_t>(v >> 16));
+		}
+		inline std::uint16_t read16(char const *data) noexcept
+		{
+			return static_cast<std::uint16_t>(static_cast<std::uint8_t>(data[0]) | (static_cast<std::uint8_t>(data[1]) << 8));
+		}
+		inline std::uint32_t read32(char const *data) noexcept
+		{
+			return read16(data) | (static_cast<std::uint32_t>(read16(data + 2)) << 16);
+		}
+		//Reads the type/variant byte and size of a TCP frame, returning the length
+		//of the header, or 0 if more data is needed to read it
+		inline std::size_t readHeader(char const *data, std::size_t available, std::uint8_t &type, Variant_t &variant, Size_t &size) noexcept
+		{
+			if(available < 2)
+			{
+				return 0;
+			}
+			type = static_cast<std::uint8_t>(data[0]) >> 4;
+			variant = static_cast<std::uint8_t>(data[0]) & 0x0F;
+			std::uint8_t const prefix = static_cast<std::uint8_t>(data[1]);
+			if(prefix < 254)
+			{
+				return size = prefix, 2;
+			}
+			if(prefix == 254)
+			{
+				return (available < 4) ? 0 : (size = read16(data + 2), 4);
+			}
+			return (available < 6) ? 0 : (size = read32(data + 2), 6);
+		}
+		//Writes the type/variant byte and size of a TCP frame, returning the length written
+		inline std::size_t writeHeader(char *out, std::uint8_t type, Variant_t variant, Size_t size) noexcept
+		{
+			SizeForm const &form = SIZE_FORMS[sizeForm(size)];
+			out[0] = static_cast<char>(type | (variant & 0x0F));
+			switch(form.length)
+			{
+				case 1: out[1] = static_cast<char>(size); break;
+				case 3: out[1] = static_cast<char>(form.marker); store16(out + 2, static_cast<std::uint16_t>(size)); break;
+				default: out[1] = static_cast<char>(form.marker); store32(out + 2, size); break;
+			}
+			return 1 + form.length;
+		}
+
+		//Encodes one kind of message whose payload follows a subchannel and
+		//a fixed number of channel/peer IDs. The type byte and the length of
+		//that fixed part are compile-time constants, so a header is written
+		//with a few stores into a buffer on the stack.
+		template<typename Kind, Kind Type, std::size_t IDs>
+		struct Encoder final
+		{
+			using IDs_t = std::array<ID_t, IDs>;
+			static constexpr std::uint8_t TYPE = static_cast<std::uint8_t>(static_cast<std::uint8_t>(Type) << 4);
+			static constexpr std::size_t FIXED = 1 + 2*IDs; //subchannel and IDs
+			static constexpr std::size_t HEADROOM = MAX_HEADER + FIXED;
+
+			//Writes everything before a payload of the given size, returning the length written
+			static std::size_t prefix(char *out, Variant_t variant, Subchannel_t subchannel, IDs_t const &ids, Size_t payload) noexcept
+			{
+				std::size_t n = writeHeader(out, TYPE, variant, static_cast<Size_t>(FIXED + payload));
+				out[n++] = static_cast<char>(subchannel);
+				for(ID_t const id : ids)
+				{
+					store16(out + n, id), n += 2;
+				}
+				return n;
+			}
+			static std::string prefix(Variant_t variant, Subchannel_t subchannel, IDs_t const &ids, Size_t payload)
+			{
+				char head[HEADROOM];
+				return std::string(head, prefix(head, variant, subchannel, ids, payload));
+			}
+			//Appends a whole frame to a buffer, growing it at most once. A buffer
+			//that already holds frames at least doubles, so appending frame after
+			//frame stays linear even where reserve allocates exactly what it is
+			//asked for; a new one gets exactly the frame's size.
+			template<typename String_t>
+			static void append(String_t &out, Variant_t variant, Subchannel_t subchannel, IDs_t const &ids, std::string const &data)
+			{
+				char head[HEADROOM];
+				std::size_t const n = prefix(head, variant, subchannel, ids, static_cast<Size_t>(data.size()));
+				std::size_t const needed = out.size() + n + data.size();
+				if(needed > out.capacity())
+				{
+					out.reserve(out.empty() ? needed : std::max(needed, 2*out.capacity()));
+				}
+				out.append(head, n);
+				out.append(data.data(), data.size());
+			}
+			static Frame_t frame(memory::Resource_t resource, Variant_t variant, Subchannel_t subchannel, IDs_t const &ids, std::string const &data)
+			{
+				memory::String_t frame {memory::Allocator_t<char>(resource)};
+				append(frame, variant, subchannel, ids, data);
+				return share(resource, std::move(frame));
+			}
+			//A message over UDP has no size, and identifies the sending client instead
+			static std::string datagram(Variant_t variant, ID_t client, Subchannel_t subchannel, IDs_t const &ids, std::string const &data)
+			{
+				std::string out (3 + FIXED, '\0');
+				out[0] = static_cast<char>(TYPE | (variant & 0x0F));
+				store16(&out[1], client);
+				out[3] = static_cast<char>(subchannel);
+				for(std::size_t i = 0; i < IDs; ++i)
+				{
+					store16(&out[4 + 2*i], ids[i]);
+				}
+				return out += data;
+			}
+		};
+		using ServerMessage        = Encoder<ToClient, ToClient::BinaryServerMessage,        0>;
+		using ServerChannelMessage = Encoder<ToClient, ToClient::BinaryServerChannelMessage, 1>;
+		using ChannelMessage       = Encoder<ToClient, ToClient::BinaryChannelMessage,       2>;
+		using PeerMessage          = Encoder<ToClient, ToClient::BinaryPeerMessage,          2>;
+		using ServerMessageRequest  = Encoder<ToServer, ToServer::BinaryServerMessage,  0>;
+		using ChannelMessageRequest = Encoder<ToServer, ToServer::BinaryChannelMessage, 1>;
+		using PeerMessageRequest    = Encoder<ToServer, ToServer::BinaryPeerMessage,    2>;
+
+		inline Frame_t leaveChannelResponse(memory::Resource_t resource, ID_t channel)
+		{
+			char frame[MAX_HEADER + 4];
+			std::size_t const n = writeHeader(frame, static_cast<std::uint8_t>(ToClient::Response) << 4, 0, 4);
+			frame[n] = static_cast<char>(Request::LeaveChannel);
+			frame[n + 1] = static_cast<char>(1); //success
+			store16(frame + n + 2, channel);
+			return share(resource, memory::String_t(frame, n + 4, resource));
+		}
+		//A peer message with no flags or name means the peer left
+		inline Frame_t peerLeft(memory::Resource_t resource, ID_t channel, ID_t peer)
+		{
+			char frame[MAX_HEADER + 4];
+			std::size_t const n = writeHeader(frame, static_cast<std::uint8_t>(ToClient::Peer) << 4, 0, 4);
+			store16(frame + n, channel);
+			store16(frame + n + 2, peer);
+			return share(resource, memory::String_t(frame, n + 4, resource));
+		}
+	}
+}
+
+#endif
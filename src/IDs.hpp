@@ -1,29 +1,58 @@
 #ifndef IdManagement_HeaderPlusPlus
 #define IdManagement_HeaderPlusPlus
-#include <set>
+#include "Memory.hpp"
+
+#include <cstddef>
 #include <limits>
+#include <stdexcept>
 
 template<typename T>
 struct IdManager final
 {
 	using ID_type = T;
-	ID_type generate() noexcept
+	IdManager(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: IDs(resource)
+	{
+	}
+	//Throws std::range_error if every ID in the range is in use
+	ID_type generate()
 	{
+		if(full())
+		{
+			throw std::range_error("no IDs left to generate");
+		}
+		//lowest is always the lowest free ID, so if the search reaches the
+		//end of the range without finding another, the range is now full
 		ID_type ret (lowest);
-		while(IDs.find(++lowest) != IDs.end())
+		IDs.insert(ret);
+		while(lowest != last && IDs.find(++lowest) != IDs.end())
 		{
 		}
-		return IDs.insert(ret), ret;
+		return ret;
 	}
 	void release(ID_type ID) noexcept
 	{
-		IDs.erase(ID);
-		lowest = (ID < lowest) ? ID : lowest;
+		if(IDs.erase(ID) != 0)
+		{
+			lowest = (ID < lowest) ? ID : lowest;
+		}
+	}
+	bool full() const noexcept
+	{
+		return IDs.size() > static_cast<std::size_t>(last - first);
+	}
+	//Releases every ID at once; holders released afterwards are ignored
+	void clear() noexcept
+	{
+		IDs.clear();
+		lowest = first;
 	}
 
 private:
-	std::set<ID_type> IDs;
-	ID_type lowest = std::numeric_limits<ID_type>::min();
+	lwrelay::memory::Set_t<ID_type> IDs;
+	static constexpr ID_type first = std::numeric_limits<ID_type>::min();
+	static constexpr ID_type last = std::numeric_limits<ID_type>::max();
+	ID_type lowest = first;
 };
 template<typename T>
 struct IdHolder final
@@ -31,7 +60,7 @@ struct IdHolder final
 	IdManager<T> &manager;
 	T const id;
 
-	IdHolder(IdManager<T> &idm) noexcept
+	IdHolder(IdManager<T> &idm)
 	: manager(idm)
 	, id(idm.generate())
 	{
@@ -0,0 +1,111 @@
+#ifndef InlineMap_HeaderPlusPlus
+#define InlineMap_HeaderPlusPlus
+#include "Memory.hpp"
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+//Unordered map stored inline for up to N entries, moving to the heap once it
+//outgrows them. Lookups are linear, which beats a tree for a handful of keys.
+template<typename K, typename V, std::size_t N>
+struct InlineMap final
+{
+	using value_type = std::pair<K, V>;
+
+	InlineMap(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: heap(resource)
+	{
+	}
+
+	value_type *begin() noexcept
+	{
+		return spilled() ? heap.data() : local.data();
+	}
+	value_type *end() noexcept
+	{
+		return begin() + count;
+	}
+	value_type const *begin() const noexcept
+	{
+		return spilled() ? heap.data() : local.data();
+	}
+	value_type const *end() const noexcept
+	{
+		return begin() + count;
+	}
+	std::size_t size() const noexcept
+	{
+		return count;
+	}
+	bool empty() const noexcept
+	{
+		return count == 0;
+	}
+	bool spilled() const noexcept
+	{
+		return heap.capacity() != 0;
+	}
+	//Heap memory used once spilled, in bytes
+	std::size_t footprint() const noexcept
+	{
+		return heap.capacity()*sizeof(value_type);
+	}
+
+	value_type *find(K const &key) noexcept
+	{
+		for(value_type &e : *this)
+		{
+			if(e.first == key)
+			{
+				return &e;
+			}
+		}
+		return nullptr;
+	}
+	bool insert(K const &key, V const &value)
+	{
+		if(find(key))
+		{
+			return false;
+		}
+		if(!spilled() && count == N)
+		{
+			heap.reserve(2*N);
+			heap.assign(local.begin(), local.end());
+		}
+		if(spilled())
+		{
+			heap.emplace_back(key, value);
+		}
+		else
+		{
+			local[count] = value_type(key, value);
+		}
+		return ++count, true;
+	}
+	void erase(K const &key) noexcept
+	{
+		if(value_type *e = find(key))
+		{
+			*e = *(end() - 1);
+			--count;
+			if(spilled())
+			{
+				heap.pop_back();
+			}
+		}
+	}
+	void clear() noexcept
+	{
+		count = 0;
+		heap.clear();
+	}
+
+private:
+	std::array<value_type, N> local {};
+	lwrelay::memory::Vector_t<value_type> heap;
+	std::size_t count = 0;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef MemoryResources_HeaderPlusPlus
+#define MemoryResources_HeaderPlusPlus
+#include <Relay.hpp>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lwrelay
+{
+	//Containers whose allocations all come from the memory resource given to
+	//the Server or Client, when std::pmr is available
+	namespace memory
+	{
+#ifdef LWRELAY_PMR
+		using Resource_t = std::pmr::memory_resource *;
+		template<typename T>
+		using Allocator_t = std::pmr::polymorphic_allocator<T>;
+		inline Resource_t defaultResource() noexcept
+		{
+			return std::pmr::get_default_resource();
+		}
+#else
+		//Without std::pmr, everything uses the global allocator and resources are always null
+		struct Resource;
+		using Resource_t = Resource *;
+		template<typename T>
+		struct Allocator_t : std::allocator<T>
+		{
+			template<typename U>
+			struct rebind
+			{
+				using other = Allocator_t<U>;
+			};
+			Allocator_t(Resource_t = nullptr) noexcept
+			{
+			}
+			template<typename U>
+			Allocator_t(Allocator_t<U> const &) noexcept
+			{
+			}
+		};
+		inline Resource_t defaultResource() noexcept
+		{
+			return nullptr;
+		}
+#endif
+		template<typename K, typename V>
+		using Map_t = std::map<K, V, std::less<K>, Allocator_t<std::pair<K const, V>>>;
+		template<typename K, typename V>
+		using UnorderedMap_t = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, Allocator_t<std::pair<K const, V>>>;
+		template<typename T>
+		using Set_t = std::set<T, std::less<T>, Allocator_t<T>>;
+		template<typename T>
+		using Vector_t = std::vector<T, Allocator_t<T>>;
+		template<typename T>
+		using Deque_t = std::deque<T, Allocator_t<T>>;
+		using String_t = std::basic_string<char, std::char_traits<char>, Allocator_t<char>>;
+	}
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef InternedNames_HeaderPlusPlus
+#define InternedNames_HeaderPlusPlus
+#include "Memory.hpp"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+struct NameTable;
+struct NameEntry final
+{
+	std::size_t refs;
+	NameTable *table;
+};
+
+//An interned, reference-counted, immutable name the size of a pointer.
+//Equal names from the same table share one string, so comparing names
+//is a pointer comparison. The empty name owns nothing.
+struct Name final
+{
+	Name() noexcept = default;
+	inline Name(NameTable &table, std::string const &name);
+	Name(Name const &from) noexcept
+	: node(from.node)
+	{
+		if(node)
+		{
+			++node->second.refs;
+		}
+	}
+	Name(Name &&from) noexcept
+	: node(from.node)
+	{
+		from.node = nullptr;
+	}
+	Name &operator=(Name from) noexcept
+	{
+		return std::swap(node, from.node), *this;
+	}
+	inline ~Name();
+
+	std::string const &str() const noexcept
+	{
+		static std::string const none;
+		return node ? node->first : none;
+	}
+	bool empty() const noexcept
+	{
+		return node == nullptr;
+	}
+	//This name's share of the memory used by its string
+	std::size_t footprint() const noexcept
+	{
+		return node ? (sizeof(*node) + node->first.capacity()) / node->second.refs : 0;
+	}
+	friend bool operator==(Name const &a, Name const &b) noexcept
+	{
+		return a.node == b.node;
+	}
+	friend bool operator!=(Name const &a, Name const &b) noexcept
+	{
+		return a.node != b.node;
+	}
+
+private:
+	std::pair<std::string const, NameEntry> *node = nullptr;
+};
+
+//Must outlive every name made from it
+struct NameTable final
+{
+	NameTable(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: names(resource)
+	{
+	}
+
+	std::size_t size() const noexcept
+	{
+		return names.size();
+	}
+
+private:
+	lwrelay::memory::UnorderedMap_t<std::string, NameEntry> names; //the strings themselves are std::string, as handed out by the API
+
+	friend struct Name;
+};
+
+Name::Name(NameTable &table, std::string const &name)
+{
+	if(!name.empty())
+	{
+		//Most names are already interned, and only a miss should build a node
+		auto it = table.names.find(name);
+		if(it == table.names.end())
+		{
+			it = table.names.emplace(name, NameEntry{0, &table}).first;
+		}
+		node = &*it;
+		++node->second.refs;
+	}
+}
+Name::~Name()
+{
+	if(node && --node->second.refs == 0)
+	{
+		node->second.table->names.erase(node->first);
+	}
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef OutboundQueue_HeaderPlusPlus
+#define OutboundQueue_HeaderPlusPlus
+#include "Frames.hpp"
+#include "Fifo.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+//A frame whose payload is pulled from a reader in chunks as recipients drain it.
+//Every recipient shares the same buffer, which never runs more than WINDOW
+//bytes ahead of the slowest recipient. A recipient that keeps the others
+//waiting on a full window for more than STALL_SECONDS is dropped from the
+//stream, so one stuck connection cannot hold up everyone else; having lost
+//a message, it must then be disconnected. Recipients are kept in a min-heap
+//on their offsets, so finding the slowest one does not scan them all.
+struct OutboundStream final
+{
+	using Reader_t = std::function<lwrelay::Server::StreamReader>;
+	using Clock_t = std::chrono::steady_clock;
+	static constexpr std::size_t WINDOW = 256*1024;
+	static constexpr int STALL_SECONDS = 5;
+
+	OutboundStream(std::string header, lwrelay::Size_t size, Reader_t r)
+	: buffer(std::move(header))
+	, total(buffer.size() + size)
+	, reader(std::move(r))
+	{
+	}
+
+	std::size_t size() const noexcept
+	{
+		return total;
+	}
+	std::size_t join()
+	{
+		std::size_t const slot = offsets.size();
+		offsets.push_back(0), dropped.push_back(false);
+		place.push_back(heap.size()), heap.push_back(slot);
+		for(std::size_t i = place[slot]; i != 0 && offsets[heap[(i - 1)/2]] > offsets[slot]; i = (i - 1)/2)
+		{
+			swap(i, (i - 1)/2);
+		}
+		return slot;
+	}
+	void leave(std::size_t slot)
+	{
+		offsets[slot] = total;
+		raise(slot);
+		trim();
+	}
+	bool done(std::size_t slot) const noexcept
+	{
+		return offsets[slot] == total;
+	}
+	//True if the given recipient was dropped for holding the others back; it
+	//will never get the rest of the frame
+	bool evicted(std::size_t slot) const noexcept
+	{
+		return dropped[slot];
+	}
+	//Returns the data the given recipient can write next, which may be empty if
+	//the reader has none yet or the recipient was evicted
+	std::pair<char const *, std::size_t> peek(std::size_t slot)
+	{
+		if(dropped[slot])
+		{
+			return {nullptr, 0};
+		}
+		pull();
+		if(offsets[slot] == base + live() && live() >= WINDOW && wait())
+		{
+			pull();
+		}
+		std::size_t const skip = head + (offsets[slot] - base);
+		return {buffer.data() + skip, buffer.size() - skip};
+	}
+	void advance(std::size_t slot, std::size_t n)
+	{
+		if(n != 0)
+		{
+			offsets[slot] += n;
+			raise(slot);
+			trim();
+		}
+	}
+
+private:
+	std::string buffer; //bytes from base on start at head; those before it are spent
+	std::size_t head = 0, base = 0;
+	std::size_t const total;
+	Reader_t reader;
+	std::vector<std::size_t> offsets;
+	std::vector<bool> dropped;
+	std::vector<std::size_t> heap, place; //slots by offset, slowest first, and where each slot is in it
+	bool waiting = false; //on the slowest recipients, with the window full
+	Clock_t::time_point waiting_since;
+
+	std::size_t live() const noexcept
+	{
+		return buffer.size() - head;
+	}
+	void pull()
+	{
+		std::size_t const end = base + live();
+		if(end < total && live() < WINDOW)
+		{
+			if(head >= WINDOW)
+			{
+				//Moves less than a window, once per window spent
+				buffer.erase(0, head);
+				head = 0;
+			}
+			std::size_t const want = std::min(WINDOW - live(), total - end);
+			std::size_t const old = buffer.size();
+			buffer.resize(old + want);
+			buffer.resize(old + std::min(want, reader(&buffer[old], want)));
+		}
+	}
+	void trim()
+	{
+		std::size_t const slowest = offsets[heap.front()];
+		if(slowest > base)
+		{
+			head += slowest - base;
+			base = slowest;
+			waiting = false;
+			if(head == buffer.size())
+			{
+				buffer.clear();
+				head = 0;
+			}
+		}
+	}
+	void swap(std::size_t i, std::size_t j) noexcept
+	{
+		std::swap(heap[i], heap[j]);
+		place[heap[i]] = i, place[heap[j]] = j;
+	}
+	//Restores the heap after the given slot's offset went up
+	void raise(std::size_t slot) noexcept
+	{
+		for(std::size_t i = place[slot]; ; )
+		{
+			std::size_t least = i;
+			for(std::size_t child = 2*i + 1; child <= 2*i + 2 && child < heap.size(); ++child)
+			{
+				least = (offsets[heap[child]] < offsets[heap[least]]) ? child : least;
+			}
+			if(least == i)
+			{
+				return;
+			}
+			swap(i, least);
+			i = least;
+		}
+	}
+	//Called by a recipient that has caught up with a full window; evicts the
+	//slowest recipients once they have kept it waiting too long, returning
+	//true if that made room
+	bool wait()
+	{
+		Clock_t::time_point const now = Clock_t::now();
+		if(!waiting)
+		{
+			waiting = true, waiting_since = now;
+			return false;
+		}
+		long const limit = STALL_SECONDS;
+		if(now - waiting_since < std::chrono::seconds(limit))
+		{
+			return false;
+		}
+		while(offsets[heap.front()] == base)
+		{
+			std::size_t const slot = heap.front();
+			dropped[slot] = true;
+			offsets[slot] = total;
+			raise(slot);
+		}
+		trim();
+		return true;
+	}
+};
+
+//Frames written back to back as a single entry, such as everything a channel
+//sent during one tick. The frames are shared with every other batch and
+//queue holding them, and the batch itself is shared by recipients that
+//receive the same frames.
+struct OutboundBatch final
+{
+	lwrelay::memory::Vector_t<lwrelay::frames::Frame_t> segments;
+	std::size_t size = 0;
+
+	OutboundBatch(lwrelay::memory::Resource_t resource)
+	: segments(resource)
+	{
+	}
+
+	void append(lwrelay::frames::Frame_t frame)
+	{
+		size += frame->size();
+		segments.push_back(std::move(frame));
+	}
+};
+
+//Per-client queue of frames waiting to be written, scheduled by priority class.
+//Frames are never split, so urgent frames overtake queued bulk frames only at
+//frame boundaries. Scheduling is deficit round robin: more urgent classes are
+//served first and earn more credit per round, but every non-empty class earns
+//some credit each round so bulk transfers are never starved.
+struct OutboundQueue final
+{
+	using Priority_t = std::uint8_t;
+	using Frame_t = lwrelay::frames::Frame_t;
+	static constexpr std::size_t CLASSES = 4;
+	static constexpr std::size_t QUANTUM = 4096;
+
+	//Either a complete frame, a batch of them, or one recipient's position in a stream
+	struct Entry final
+	{
+		Frame_t frame;
+		std::shared_ptr<OutboundBatch const> batch;
+		std::shared_ptr<OutboundStream> stream;
+		std::size_t slot = 0;
+
+		Entry() = default;
+		Entry(Frame_t f) noexcept
+		: frame(std::move(f))
+		{
+		}
+		Entry(std::shared_ptr<OutboundBatch const> b) noexcept
+		: batch(std::move(b))
+		{
+		}
+		Entry(std::shared_ptr<OutboundStream> s)
+		: stream(std::move(s))
+		, slot(stream->join())
+		{
+		}
+		Entry(Entry &&from) noexcept
+		: frame(std::move(from.frame))
+		, batch(std::move(from.batch))
+		, stream(std::move(from.stream))
+		, slot(from.slot)
+		{
+		}
+		Entry &operator=(Entry &&from) noexcept
+		{
+			release();
+			frame = std::move(from.frame);
+			batch = std::move(from.batch);
+			stream = std::move(from.stream);
+			slot = from.slot;
+			return *this;
+		}
+		~Entry()
+		{
+			release();
+		}
+
+		std::size_t size() const noexcept
+		{
+			return stream ? stream->size() : batch ? batch->size : frame->size();
+		}
+
+	private:
+		void release()
+		{
+			if(stream && !stream->done(slot))
+			{
+				stream->leave(slot);
+			}
+		}
+	};
+
+	OutboundQueue(lwrelay::memory::Resource_t resource = lwrelay::memory::defaultResource())
+	: classes{{Class(resource), Class(resource), Class(resource), Class(resource)}}
+	{
+		static_assert(CLASSES == 4, "initialize every class with the resource");
+	}
+
+	void push(Priority_t priority, Entry entry)
+	{
+		std::size_t const c = (priority < CLASSES) ? priority : CLASSES - 1;
+		classes[c].entries.push_back(std::move(entry));
+	}
+	//Drops every queued stream nothing has been written from yet, leaving
+	//them so this recipient no longer holds the others back
+	void dropStreams()
+	{
+		for(auto &c : classes)
+		{
+			c.entries.remove_if([](Entry const &e){ return e.stream != nullptr; });
+			c.deficit = c.entries.empty() ? 0 : c.deficit;
+		}
+	}
+	bool empty() const noexcept
+	{
+		for(auto const &c : classes)
+		{
+			if(!c.entries.empty())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	//Bytes allocated for the classes' queues, not counting the frames in them
+	std::size_t footprint() const noexcept
+	{
+		std::size_t bytes = 0;
+		for(auto const &c : classes)
+		{
+			bytes += c.entries.footprint();
+		}
+		return bytes;
+	}
+	//Removes and returns the next entry to write; the queue must not be empty
+	Entry pop()
+	{
+		for(;;)
+		{
+			for(auto &c : classes)
+			{
+				if(!c.entries.empty() && c.deficit >= c.entries.front().size())
+				{
+					Entry entry = std::move(c.entries.front());
+					c.entries.pop_front();
+					c.deficit = c.entries.empty() ? 0 : c.deficit - entry.size();
+					return entry;
+				}
+			}
+			refill();
+		}
+	}
+
+private:
+	struct Class final
+	{
+		Fifo<Entry> entries; //allocates nothing while the class has never been used
+		std::size_t deficit = 0;
+
+		Class(lwrelay::memory::Resource_t resource)
+		: entries(resource)
+		{
+		}
+	};
+	std::array<Class, CLASSES> classes;
+
+	static std::size_t quantum(std::size_t c) noexcept
+	{
+		return QUANTUM << (CLASSES - 1 - c); //weights 8:4:2:1
+	}
+	//Skips ahead as many rounds as it takes for some class to afford its next entry
+	void refill() noexcept
+	{
+		std::size_t rounds = 0;
+		for(std::size_t c = 0; c < CLASSES; ++c)
+		{
+			if(!classes[c].entries.empty())
+			{
+				std::size_t const owed = classes[c].entries.front().size() - classes[c].deficit;
+				std::size_t const r = (owed + quantum(c) - 1) / quantum(c);
+				rounds = (rounds == 0 || r < rounds) ? r : rounds;
+			}
+		}
+		rounds = (rounds == 0) ? 1 : rounds;
+		for(std::size_t c = 0; c < CLASSES; ++c)
+		{
+			if(!classes[c].entries.empty())
+			{
+				classes[c].deficit += rounds * quantum(c);
+			}
+		}
+	}
+};
+
+#endif
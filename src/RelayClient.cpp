@@ -1,6 +1,14 @@
+#include "Names.hpp"
+#include "Compression.hpp"
+#include "FlatMap.hpp"
+#include "Frames.hpp"
+#include "Trace.hpp"
+
 #include <Relay.hpp>
 
-#iclude <sstream>
+#include <bitset>
+#include <limits>
+#include <sstream>
 
 namespace lwrelay
 {
@@ -10,13 +18,22 @@ namespace lwrelay
 		lacewing::pump pump;
 		lacewing::client client;
 		lacewing::udp udp;
+		memory::Resource_t resource;
 
-		Impl(Client &pc, lacewing::pump p)
+		Impl(Client &pc, lacewing::pump p, memory::Resource_t r)
 		: interf(pc)
 		, pump(p)
 		, client(lacewing::client_new(p))
 		, udp(lacewing::udp_new(p))
+		, resource(r)
+		, names(r)
+		, channels(r)
+		, batch(r)
+		, partial(r)
 		{
+			client->tag(this);
+			client->on_connect(lwConnect);
+			client->on_data(lwData);
 		}
 		~Impl()
 		{
@@ -25,6 +42,54 @@ namespace lwrelay
 			lacewing::client_delete(client), client = nullptr;
 		}
 
+		NameTable names; //shared by channels and peers, must outlive them
+		using Channels_t = FlatMap<ID_t, std::unique_ptr<Channel>>;
+		Channels_t channels;
+
+		ID_t id = 0;
+		bool udp_ready = false; //set once the server has welcomed our UDP hello
+
+		//Outgoing TCP messages waiting to be flushed, when batching
+		bool batching = false;
+		std::size_t batch_threshold = 0;
+		memory::String_t batch;
+		std::shared_ptr<Impl *> const self {std::make_shared<Impl *>(this)};
+
+		template<typename Encoder>
+		void send(Protocol protocol, Variant_t variant, Subchannel_t subchannel, typename Encoder::IDs_t const &ids, std::string const &data);
+		void flush();
+		static void lw_callback deferredFlush(void *tag);
+
+		memory::String_t partial; //incomplete frame left over from the last receive
+		std::uint64_t received = 0; //bytes of complete frames received on this connection
+		std::string payload; //reused for handlers that take a std::string, and for inflated payloads
+
+		//Subchannels the server compresses, and the dictionary it uses
+		std::bitset<256> compressed;
+		Decompressor decompressor;
+
+		void receive(char const *data, std::size_t size);
+		std::size_t consume(char const *data, std::size_t size);
+		void dispatch(std::uint8_t type, Variant_t variant, char const *body, Size_t size);
+		bool unpack(Subchannel_t subchannel, Variant_t &variant, char const *&data, std::size_t &size);
+		//Calls the handler taking a view of the payload if there is one, or else the one taking a std::string
+		template<typename View, typename Copy, typename... Args>
+		void deliver(View const &view, Copy const &copy, char const *data, std::size_t size, Args &&... args)
+		{
+			if(view)
+			{
+				view(std::forward<Args>(args)..., data, size);
+				return;
+			}
+			if(data != payload.data())
+			{
+				payload.assign(data, size);
+			}
+			copy(std::forward<Args>(args)..., payload);
+		}
+		static void lw_callback lwConnect(lacewing::client client);
+		static void lw_callback lwData(lacewing::client client, char const *data, std::size_t size);
+
 		//
 
 		std::function<               ErrorHandler> onError;
@@ -43,6 +108,10 @@ namespace lwrelay
 		std::function<ServerChannelMessageHandler> onServerChannelMessage;
 		std::function<      ChannelMessageHandler> onChannelMessage;
 		std::function<         PeerMessageHandler> onPeerMessage;
+		std::function<       ServerMessageViewHandler> onServerMessageView;
+		std::function<ServerChannelMessageViewHandler> onServerChannelMessageView;
+		std::function<      ChannelMessageViewHandler> onChannelMessageView;
+		std::function<         PeerMessageViewHandler> onPeerMessageView;
 		std::function<            PeerJoinHandler> onPeerJoin;
 		std::function<           PeerLeaveHandler> onPeerLeave;
 		std::function<      PeerChangeNameHandler> onPeerChangeName;
@@ -53,14 +122,15 @@ namespace lwrelay
 	{
 		Client::Impl &client;
 		ID_t const id;
-		std::string name;
-		using Peers_t = std::map<ID_t, std::unique_ptr<Peer>>;
+		Name name;
+		using Peers_t = FlatMap<ID_t, std::unique_ptr<Peer>>;
 		Peers_t peers;
 
 		Impl(Client::Impl &ci, ID_t Id, std::string const &n)
 		: client(ci)
 		, id(Id)
-		, name(n)
+		, name(ci.names, n)
+		, peers(ci.resource)
 		{
 		}
 		~Impl()
@@ -74,12 +144,12 @@ namespace lwrelay
 	{
 		Channel::Impl &channel;
 		ID_t const id;
-		std::string name;
+		Name name;
 
 		Impl(Channel::Impl &ci, ID_t Id, std::string const &n)
 		: channel(ci)
 		, id(Id)
-		, name(n)
+		, name(ci.client.names, n)
 		{
 		}
 		~Impl()
@@ -89,4 +159,251 @@ namespace lwrelay
 
 		//
 	};
+
+	void Client::Impl::receive(char const *data, std::size_t size)
+	{
+		//Complete frames are dispatched straight from the lacewing buffer; only
+		//leftovers are copied, along with as much as it takes to complete them
+		while(!partial.empty())
+		{
+			std::uint8_t type;
+			Variant_t variant;
+			Size_t length;
+			std::size_t const header = frames::readHeader(partial.data(), partial.size(), type, variant, length);
+			if(header != 0 && partial.size() - header >= length)
+			{
+				consume(partial.data(), partial.size());
+				partial.clear();
+				break;
+			}
+			if(size == 0)
+			{
+				return;
+			}
+			std::size_t const take = (header == 0) ? 1 : std::min<std::size_t>(header + length - partial.size(), size);
+			partial.append(data, take);
+			data += take, size -= take;
+		}
+		std::size_t const used = consume(data, size);
+		partial.assign(data + used, size - used);
+	}
+	std::size_t Client::Impl::consume(char const *data, std::size_t size)
+	{
+		LWRELAY_TRACE_SCOPE("Client parse");
+		std::size_t used = 0;
+		for(;;)
+		{
+			std::uint8_t type;
+			Variant_t variant;
+			Size_t length;
+			std::size_t const header = frames::readHeader(data + used, size - used, type, variant, length);
+			if(header == 0 || size - used - header < length)
+			{
+				return used;
+			}
+			dispatch(type, variant, data + used + header, length);
+			used += header + length;
+			received += header + length;
+		}
+	}
+	void Client::Impl::dispatch(std::uint8_t type, Variant_t variant, char const *body, Size_t size)
+	{
+		using frames::ToClient;
+		using frames::read16;
+		switch(static_cast<ToClient>(type))
+		{
+			case ToClient::BinaryServerMessage:
+			{
+				if(size < 1 || !(onServerMessage || onServerMessageView)) break;
+				Subchannel_t const subchannel = static_cast<Subchannel_t>(body[0]);
+				char const *data = body + 1;
+				std::size_t length = size - 1;
+				if(!unpack(subchannel, variant, data, length)) break;
+				LWRELAY_TRACE_SCOPE("onServerMessage");
+				deliver(onServerMessageView, onServerMessage, data, length, interf, Protocol::TCP, subchannel, variant);
+			} break;
+			case ToClient::BinaryServerChannelMessage:
+			{
+				if(size < 3 || !(onServerChannelMessage || onServerChannelMessageView)) break;
+				auto channel = channels.find(read16(body + 1));
+				if(!channel) break;
+				Subchannel_t const subchannel = static_cast<Subchannel_t>(body[0]);
+				char const *data = body + 3;
+				std::size_t length = size - 3;
+				if(!unpack(subchannel, variant, data, length)) break;
+				LWRELAY_TRACE_SCOPE("onServerChannelMessage");
+				deliver(onServerChannelMessageView, onServerChannelMessage, data, length, interf, **channel, Protocol::TCP, subchannel, variant);
+			} break;
+			case ToClient::BinaryChannelMessage:
+			case ToClient::BinaryPeerMessage:
+			{
+				bool const broadcast = (static_cast<ToClient>(type) == ToClient::BinaryChannelMessage);
+				auto const &view = broadcast ? onChannelMessageView : onPeerMessageView;
+				auto const &copy = broadcast ? onChannelMessage : onPeerMessage;
+				if(size < 5 || !(copy || view)) break;
+				auto channel = channels.find(read16(body + 1));
+				if(!channel) break;
+				auto peer = (*channel)->impl->peers.find(read16(body + 3));
+				if(!peer) break;
+				LWRELAY_TRACE_SCOPE(broadcast ? "onChannelMessage" : "onPeerMessage");
+				deliver(view, copy, body + 5, size - 5, interf, **channel, **peer, Protocol::TCP, static_cast<Subchannel_t>(body[0]), variant);
+			} break;
+			default:
+			{
+				//
+			} break;
+		}
+	}
+	//Leaves data and size alone unless the server compressed the payload, in
+	//which case it is inflated into payload and they are pointed at that
+	bool Client::Impl::unpack(Subchannel_t subchannel, Variant_t &variant, char const *&data, std::size_t &size)
+	{
+		if(!compressed[subchannel] || (variant & frames::COMPRESSED) == 0)
+		{
+			return true;
+		}
+		variant = static_cast<Variant_t>(variant & ~frames::COMPRESSED);
+		if(decompressor.decompress(data, size, payload, std::numeric_limits<Size_t>::max()))
+		{
+			data = payload.data(), size = payload.size();
+			return true;
+		}
+		if(onError)
+		{
+			lacewing::error error = lacewing::error_new();
+			error->add("Could not decompress a message on subchannel %d", static_cast<int>(subchannel));
+			onError(interf, error);
+			lacewing::error_delete(error), error = nullptr;
+		}
+		return false;
+	}
+	void lw_callback Client::Impl::lwConnect(lacewing::client client)
+	{
+		Impl &c = *static_cast<Impl *>(client->tag());
+		c.partial.clear();
+		c.received = 0;
+	}
+	void lw_callback Client::Impl::lwData(lacewing::client client, char const *data, std::size_t size)
+	{
+		static_cast<Impl *>(client->tag())->receive(data, size);
+	}
+
+	template<typename Encoder>
+	void Client::Impl::send(Protocol protocol, Variant_t variant, Subchannel_t subchannel, typename Encoder::IDs_t const &ids, std::string const &data)
+	{
+		if(protocol == Protocol::UDP && udp_ready)
+		{
+			//Datagrams carry no size, so the protocol cannot pack several into one
+			std::string const datagram = Encoder::datagram(variant, id, subchannel, ids, data);
+			LWRELAY_TRACE_SCOPE("Client UDP send");
+			udp->send(client->server_address(), datagram.data(), datagram.size());
+			return;
+		}
+		if(!batching)
+		{
+			memory::String_t frame (resource);
+			Encoder::append(frame, variant, subchannel, ids, data);
+			client->write(frame.data(), frame.size());
+			return;
+		}
+		if(batch.empty())
+		{
+			pump->post(reinterpret_cast<void *>(&deferredFlush), new std::weak_ptr<Impl *>(self));
+		}
+		Encoder::append(batch, variant, subchannel, ids, data);
+		if(batch.size() >= batch_threshold)
+		{
+			flush();
+		}
+	}
+	void Client::Impl::flush()
+	{
+		LWRELAY_TRACE_SCOPE("Client flush");
+		if(!batch.empty())
+		{
+			client->write(batch.data(), batch.size());
+			batch.clear();
+		}
+	}
+	void lw_callback Client::Impl::deferredFlush(void *tag)
+	{
+		std::unique_ptr<std::weak_ptr<Impl *>> weak (static_cast<std::weak_ptr<Impl *> *>(tag));
+		if(auto self = weak->lock())
+		{
+			(*self)->flush();
+		}
+	}
+
+	Client::Client(lacewing::pump pump)
+	: impl(new Impl(*this, pump, memory::defaultResource()))
+	{
+	}
+#ifdef LWRELAY_PMR
+	Client::Client(lacewing::pump pump, std::pmr::memory_resource *resource)
+	: impl(new Impl(*this, pump, resource))
+	{
+	}
+#endif
+	Client::~Client() = default;
+
+	void Client::setBatching(bool enabled, std::size_t threshold)
+	{
+		if(!enabled)
+		{
+			impl->flush();
+		}
+		impl->batching = enabled;
+		impl->batch_threshold = threshold;
+	}
+	void Client::flush()
+	{
+		impl->flush();
+	}
+	std::uint64_t Client::received() const noexcept
+	{
+		return impl->received;
+	}
+	void Client::setCompression(Subchannel_t subchannel, bool enabled)
+	{
+		impl->compressed[subchannel] = enabled;
+	}
+	void Client::setCompressionDictionary(std::string const &dictionary)
+	{
+		impl->decompressor.dictionary(dictionary);
+	}
+	void Client::send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data)
+	{
+		impl->send<frames::ServerMessageRequest>(protocol, variant, subchannel, {}, data);
+	}
+	void Client::Channel::send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data)
+	{
+		impl->client.send<frames::ChannelMessageRequest>(protocol, variant, subchannel, {{impl->id}}, data);
+	}
+	void Client::Channel::Peer::send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data)
+	{
+		impl->channel.client.send<frames::PeerMessageRequest>(protocol, variant, subchannel, {{impl->channel.id, impl->id}}, data);
+	}
+	void Client::onError               (std::function<                   ErrorHandler> handler){ impl->onError                    = handler; }
+	void Client::onConnect             (std::function<                 ConnectHandler> handler){ impl->onConnect                  = handler; }
+	void Client::onConnectionDenied    (std::function<        ConnectionDeniedHandler> handler){ impl->onConnectionDenied         = handler; }
+	void Client::onDisconnect          (std::function<              DisconnectHandler> handler){ impl->onDisconnect               = handler; }
+	void Client::onChannelListReceived (std::function<     ChannelListReceivedHandler> handler){ impl->onChannelListReceived      = handler; }
+	void Client::onNameSet             (std::function<                 NameSetHandler> handler){ impl->onNameSet                  = handler; }
+	void Client::onNameChanged         (std::function<             NameChangedHandler> handler){ impl->onNameChanged              = handler; }
+	void Client::onNameDenied          (std::function<              NameDeniedHandler> handler){ impl->onNameDenied               = handler; }
+	void Client::onChannelJoin         (std::function<             ChannelJoinHandler> handler){ impl->onChannelJoin              = handler; }
+	void Client::onChannelJoinDenied   (std::function<       ChannelJoinDeniedHandler> handler){ impl->onChannelJoinDenied        = handler; }
+	void Client::onChannelLeave        (std::function<            ChannelLeaveHandler> handler){ impl->onChannelLeave             = handler; }
+	void Client::onChannelLeaveDenied  (std::function<      ChannelLeaveDeniedHandler> handler){ impl->onChannelLeaveDenied       = handler; }
+	void Client::onServerMessage       (std::function<           ServerMessageHandler> handler){ impl->onServerMessage            = handler; }
+	void Client::onServerChannelMessage(std::function<    ServerChannelMessageHandler> handler){ impl->onServerChannelMessage     = handler; }
+	void Client::onChannelMessage      (std::function<          ChannelMessageHandler> handler){ impl->onChannelMessage           = handler; }
+	void Client::onPeerMessage         (std::function<             PeerMessageHandler> handler){ impl->onPeerMessage              = handler; }
+	void Client::onPeerJoin            (std::function<                PeerJoinHandler> handler){ impl->onPeerJoin                 = handler; }
+	void Client::onPeerLeave           (std::function<               PeerLeaveHandler> handler){ impl->onPeerLeave                = handler; }
+	void Client::onPeerChangeName      (std::function<          PeerChangeNameHandler> handler){ impl->onPeerChangeName           = handler; }
+	void Client::onServerMessage       (std::function<       ServerMessageViewHandler> handler){ impl->onServerMessageView        = handler; }
+	void Client::onServerChannelMessage(std::function<ServerChannelMessageViewHandler> handler){ impl->onServerChannelMessageView = handler; }
+	void Client::onChannelMessage      (std::function<      ChannelMessageViewHandler> handler){ impl->onChannelMessageView       = handler; }
+	void Client::onPeerMessage         (std::function<         PeerMessageViewHandler> handler){ impl->onPeerMessageView          = handler; }
 }
@@ -1,8 +1,21 @@
-#incldue "IDs.hpp"
+#include "IDs.hpp"
+#include "Outbound.hpp"
+#include "Compression.hpp"
+#include "Capture.hpp"
+#include "Names.hpp"
+#include "InlineMap.hpp"
+#include "WebSocket.hpp"
+#include "Trace.hpp"
 
 #include <Relay.hpp>
 
-#iclude <sstream>
+#include <sstream>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <random>
+#include <stdexcept>
 
 namespace lwrelay
 {
@@ -12,17 +25,43 @@ namespace lwrelay
 		lacewing::pump pump;
 		lacewing::server server;
 		lacewing::udp udp;
+		memory::Resource_t resource;
 
-		Impl(Server &ps, lacewing::pump p)
+		Impl(Server &ps, lacewing::pump p, memory::Resource_t r)
 		: interf(ps)
 		, pump(p)
 		, server(lacewing::server_new(p))
 		, udp(lacewing::udp_new(p))
+		, resource(r)
+		, names(r)
+		, client_IDs(r)
+		, channel_IDs(r)
+		, clients(r)
+		, channels(r)
+		, flushing(r)
+		, stalled(r)
+		, drain_timer(lacewing::timer_new(p))
+		, retired(r)
+		, departures(r)
+		, departed(r)
+		, sessions(r)
+		, session_timer(lacewing::timer_new(p))
 		{
+			server->tag(this);
+			server->on_connect(lwConnect);
+			server->on_disconnect(lwDisconnect);
+			server->on_data(lwData);
+			server->on_error(lwError);
+			session_timer->tag(this);
+			session_timer->on_tick(lwSessionTick);
+			drain_timer->tag(this);
+			drain_timer->on_tick(lwDrainTick);
 		}
 		~Impl()
 		{
 			//
+			lacewing::timer_delete(drain_timer), drain_timer = nullptr;
+			lacewing::timer_delete(session_timer), session_timer = nullptr;
 			lacewing::udp_delete(udp), udp = nullptr;
 			lacewing::server_delete(server), server = nullptr;
 		}
@@ -30,12 +69,84 @@ namespace lwrelay
 		bool channel_listing = true;
 		std::string welcome_message = lw_version();
 
+		NameTable names; //must outlive clients and channels
 		IdManager<ID_t> client_IDs, channel_IDs;
-		using Clients_t = std::map<ID_t, std::unique_ptr<Client>>;
-		using Channels_t = std::map<ID_t, std::unique_ptr<Channel>>;
+		using Clients_t = memory::Map_t<ID_t, std::unique_ptr<Client>>;
+		using Channels_t = memory::Map_t<ID_t, std::unique_ptr<Channel>>;
 		Clients_t clients;
 		Channels_t channels;
 
+		//Priority class of each subchannel, indexed by protocol
+		std::array<std::array<OutboundQueue::Priority_t, 256>, 2> priorities {};
+		//Subchannels whose payloads are deflated for clients that agreed to compression
+		std::bitset<256> compressed;
+		Compressor compressor;
+		//Throws unless the variant leaves room for the compressed flag on a compressed subchannel
+		void checkVariant(Subchannel_t subchannel, Variant_t variant) const
+		{
+			if(compressed[subchannel] && variant >= frames::COMPRESSED)
+			{
+				throw std::invalid_argument("compressed subchannels only carry variants 0 to 7");
+			}
+		}
+		//Clients with queued frames, flushed once per pump iteration
+		memory::Set_t<ID_t> flushing;
+		std::shared_ptr<Impl *> const self {std::make_shared<Impl *>(this)};
+		//Most bytes a client may have waiting in lacewing's buffer; frames stay
+		//in the priority queues until the socket drains below this
+		static constexpr std::size_t FLUSH_BUDGET = 64*1024;
+		//Clients that could not make progress, because their socket is not
+		//draining or a stream is waiting on its reader, retried every DRAIN_MS
+		memory::Set_t<ID_t> stalled;
+		lacewing::timer drain_timer;
+		static constexpr long DRAIN_MS = 5;
+
+		//Clients replaced by resumed sessions, destroyed on the next flush
+		memory::Vector_t<std::unique_ptr<Client>> retired;
+		//Peers that left each channel since the last flush, which tells the
+		//remaining members in one batch, so nobody hears about the others
+		//leaving with them; departed clients are kept until then, so that
+		//their IDs are not reused before the notices go out
+		memory::Map_t<ID_t, std::shared_ptr<OutboundBatch>> departures;
+		memory::Vector_t<std::unique_ptr<Client>> departed;
+		bool notifying = false; //whether a flush is coming to send them
+		void notifyLater();
+		void notify();
+
+		void queue(Client::Impl &client, Protocol protocol, Subchannel_t subchannel, OutboundQueue::Entry entry);
+		void queue(Client::Impl &client, OutboundQueue::Priority_t priority, OutboundQueue::Entry entry);
+		void schedule(ID_t client);
+		void flush();
+		static void lw_callback deferredFlush(void *tag);
+		static void lw_callback lwDrainTick(lacewing::timer timer);
+
+		//Disconnected clients are held for grace_period while their token is in sessions
+		std::chrono::milliseconds grace_period {0};
+		std::size_t session_buffer = 0;
+		memory::Map_t<std::string, ID_t> sessions;
+		lacewing::timer session_timer;
+		std::random_device entropy;
+
+		Recorder recorder;
+
+		std::string newToken();
+		void wrote(Client::Impl &client, frames::Frame_t const &frame);
+		void suspend(Client::Impl &client);
+		void expire(ID_t client);
+		void part(Client::Impl &client);
+		void close(Channel::Impl &channel);
+		void teardown();
+		static void lw_callback lwSessionTick(lacewing::timer timer);
+
+		void upgrade(Client::Impl &client, char const *data, std::size_t size);
+		void unwrap(Client::Impl &client, char const *data, std::size_t size);
+		void receive(Client::Impl &client, char const *data, std::size_t size);
+
+		static void lw_callback lwConnect(lacewing::server server, lacewing::server_client client);
+		static void lw_callback lwDisconnect(lacewing::server server, lacewing::server_client client);
+		static void lw_callback lwData(lacewing::server server, lacewing::server_client client, char const *data, std::size_t size);
+		static void lw_callback lwError(lacewing::server server, lacewing::error error);
+
 		std::function<         ErrorHandler> onError;
 		std::function<       ConnectHandler> onConnect;
 		std::function<    DisconnectHandler> onDisconnect;
@@ -54,16 +165,35 @@ namespace lwrelay
 		Server::Impl &server;
 		lacewing::server_client client;
 		IdHolder<ID_t> id;
-		std::string name;
+		Name name;
 		bool http;
-		using Channels_t = Server::Impl::Channels_t;
+		bool identified = false; //whether the first byte, which tells relay clients from HTTP ones, has arrived
+		bool upgraded = false; //whether the HTTP client has switched to a WebSocket
+		std::string request; //HTTP request received so far, until the upgrade
+		websocket::Decoder websocket;
+		bool compression = false;
+		using Channels_t = InlineMap<ID_t, Channel *, 4>; //most clients are in only a few channels
 		Channels_t channels;
+		OutboundQueue outbound;
+		OutboundQueue::Entry streaming; //stream being written, which no other frame may interrupt
+		std::string token; //session token, if sessions are resumable
+		std::chrono::steady_clock::time_point suspended; //when the connection was lost
+		std::size_t missed = 0; //bytes queued since the connection was lost
+		std::uint64_t sent = 0; //bytes of relay frames written on this connection
+		//The last frames written, at least session_buffer bytes of them, kept while
+		//sessions are resumable so that those lost in flight can be sent again;
+		//the last resending of them are still to be written after a resume
+		Fifo<frames::Frame_t> history;
+		std::size_t history_size = 0, resending = 0;
 
 		Impl(Server::Impl &si, lacewing::server_client sc, bool HTTP)
 		: server(si)
 		, client(sc)
 		, id(si.client_IDs)
 		, http(HTTP)
+		, channels(si.resource)
+		, outbound(si.resource)
+		, history(si.resource)
 		{
 		}
 		~Impl()
@@ -74,38 +204,730 @@ namespace lwrelay
 		//
 	};
 	Server::Client &Server::Client::operator=(Server::Client &&) noexcept = default;
+
+	void Server::Impl::queue(Client::Impl &client, Protocol protocol, Subchannel_t subchannel, OutboundQueue::Entry entry)
+	{
+		queue(client, priorities[static_cast<std::size_t>(protocol)][subchannel], std::move(entry));
+	}
+	void Server::Impl::queue(Client::Impl &client, OutboundQueue::Priority_t priority, OutboundQueue::Entry entry)
+	{
+		if(!client.client)
+		{
+			if(entry.stream)
+			{
+				return; //streams are not kept, or they would wait on this session until it resumed
+			}
+			//Suspended sessions keep what they miss for replay, until it no longer fits
+			client.missed += entry.size();
+			if(client.missed > session_buffer)
+			{
+				sessions.erase(client.token);
+				return;
+			}
+		}
+		client.outbound.push(priority, std::move(entry));
+		if(client.client)
+		{
+			schedule(client.id);
+		}
+	}
+	void Server::Impl::schedule(ID_t client)
+	{
+		if(flushing.empty())
+		{
+			pump->post(reinterpret_cast<void *>(&deferredFlush), new std::weak_ptr<Impl *>(self));
+		}
+		flushing.insert(client);
+	}
+	void Server::Impl::flush()
+	{
+		LWRELAY_TRACE_SCOPE("Server flush");
+		notify();
+		retired.clear();
+		//Clients scheduled during the flush, such as by a stream reader that
+		//sends, go into a fresh set that posts its own flush
+		memory::Set_t<ID_t> scheduled (resource), backlogged (resource);
+		scheduled.swap(flushing);
+		for(ID_t const id : scheduled)
+		{
+			auto it = clients.find(id);
+			if(it == clients.end() || !it->second->impl->client || !it->second->impl->identified || (it->second->impl->http && !it->second->impl->upgraded))
+			{
+				continue; //scheduled again once identified as a relay client, or upgraded
+			}
+			Client::Impl &c = *it->second->impl;
+			std::size_t const queued = c.client->queued();
+			if(queued >= FLUSH_BUDGET)
+			{
+				stalled.insert(id);
+				continue;
+			}
+			std::size_t const budget = FLUSH_BUDGET - queued;
+			std::size_t written = 0;
+			//WebSocket clients get each frame as one binary message; the shared
+			//frame is written as is, right behind a header made for this client
+			auto const wrap = [&](std::size_t length)
+			{
+				if(c.upgraded)
+				{
+					char header[websocket::MAX_HEADER];
+					std::size_t const n = websocket::header(header, websocket::Opcode::Binary, length);
+					c.client->write(header, n);
+					written += n;
+				}
+			};
+			c.client->cork();
+			bool evicted = false;
+			while(written < budget)
+			{
+				if(c.streaming.stream)
+				{
+					if(c.streaming.stream->evicted(c.streaming.slot))
+					{
+						//Dropped for holding up the other recipients mid-frame,
+						//so the connection cannot carry anything else
+						c.streaming = OutboundQueue::Entry();
+						evicted = true;
+						break;
+					}
+					auto const chunk = c.streaming.stream->peek(c.streaming.slot);
+					std::size_t const n = std::min(chunk.second, budget - written);
+					if(n != 0)
+					{
+						c.client->write(chunk.first, n);
+					}
+					c.streaming.stream->advance(c.streaming.slot, n);
+					written += n;
+					c.sent += n;
+					if(n != 0 && !c.history.empty())
+					{
+						//Streams are never sent again, so nothing before them can be either
+						c.history.clear();
+						c.history_size = 0;
+					}
+					if(!c.streaming.stream->done(c.streaming.slot))
+					{
+						break; //out of budget, or waiting on the reader or slower recipients
+					}
+					c.streaming = OutboundQueue::Entry();
+				}
+				else if(c.resending != 0)
+				{
+					frames::Frame_t const &frame = c.history[c.history.size() - c.resending--];
+					wrap(frame->size());
+					c.client->write(frame->data(), frame->size());
+					written += frame->size();
+					c.sent += frame->size(), c.history_size += frame->size();
+				}
+				else if(!c.outbound.empty())
+				{
+					OutboundQueue::Entry entry = c.outbound.pop();
+					if(entry.stream)
+					{
+						if(entry.stream->evicted(entry.slot))
+						{
+							//Dropped before it started, so this client would silently
+							//miss a message from an in-order stream
+							evicted = true;
+							break;
+						}
+						wrap(entry.stream->size());
+						c.streaming = std::move(entry);
+						continue;
+					}
+					if(entry.batch)
+					{
+						for(frames::Frame_t const &segment : entry.batch->segments)
+						{
+							wrap(segment->size());
+							c.client->write(segment->data(), segment->size());
+							wrote(c, segment);
+						}
+						written += entry.batch->size;
+						continue;
+					}
+					wrap(entry.frame->size());
+					c.client->write(entry.frame->data(), entry.frame->size());
+					written += entry.frame->size();
+					wrote(c, entry.frame);
+				}
+				else
+				{
+					break;
+				}
+			}
+			c.client->uncork();
+			if(evicted)
+			{
+				c.client->close();
+				continue;
+			}
+			if(c.streaming.stream || c.resending != 0 || !c.outbound.empty())
+			{
+				//Only go again next iteration if this one got somewhere and the socket took it
+				bool const progressing = (written != 0 && c.client->queued() < FLUSH_BUDGET);
+				(progressing ? backlogged : stalled).insert(id);
+			}
+		}
+		for(ID_t const id : backlogged)
+		{
+			schedule(id);
+		}
+		if(!stalled.empty() && !drain_timer->started())
+		{
+			drain_timer->start(DRAIN_MS);
+		}
+	}
+	void lw_callback Server::Impl::deferredFlush(void *tag)
+	{
+		std::unique_ptr<std::weak_ptr<Impl *>> weak (static_cast<std::weak_ptr<Impl *> *>(tag));
+		if(auto self = weak->lock())
+		{
+			(*self)->flush();
+		}
+	}
+	void lw_callback Server::Impl::lwDrainTick(lacewing::timer timer)
+	{
+		Impl &s = *static_cast<Impl *>(timer->tag());
+		timer->stop();
+		for(ID_t const id : s.stalled)
+		{
+			s.schedule(id);
+		}
+		s.stalled.clear();
+	}
+	std::string Server::Impl::newToken()
+	{
+		static char const hex[] = "0123456789abcdef";
+		std::string token;
+		for(int i = 0; i < 4; ++i)
+		{
+			std::uint32_t bits = entropy();
+			for(int j = 0; j < 8; ++j, bits >>= 4)
+			{
+				token += hex[bits & 0xF];
+			}
+		}
+		return token;
+	}
+	void Server::Impl::wrote(Client::Impl &client, frames::Frame_t const &frame)
+	{
+		client.sent += frame->size();
+		if(client.token.empty())
+		{
+			return;
+		}
+		client.history.push_back(frame);
+		client.history_size += frame->size();
+		while(!client.history.empty() && client.history_size >= session_buffer + client.history.front()->size())
+		{
+			client.history_size -= client.history.front()->size();
+			client.history.pop_front();
+		}
+	}
+	void Server::Impl::suspend(Client::Impl &client)
+	{
+		client.client = nullptr;
+		client.suspended = std::chrono::steady_clock::now();
+		client.missed = 0;
+		client.streaming = OutboundQueue::Entry(); //a partly written frame cannot be resumed
+		client.outbound.dropStreams(); //nor can queued streams wait for the session to resume
+		sessions.emplace(client.token, client.id);
+		if(!session_timer->started())
+		{
+			session_timer->start(1000);
+		}
+	}
+	void Server::Impl::expire(ID_t client)
+	{
+		auto it = clients.find(client);
+		if(onDisconnect)
+		{
+			LWRELAY_TRACE_SCOPE("onDisconnect");
+			onDisconnect(interf, *it->second);
+		}
+		part(*it->second->impl);
+		it->second->impl->client = nullptr;
+		departed.push_back(std::move(it->second));
+		clients.erase(it);
+		notifyLater();
+	}
+	void lw_callback Server::Impl::lwSessionTick(lacewing::timer timer)
+	{
+		Impl &s = *static_cast<Impl *>(timer->tag());
+		auto const now = std::chrono::steady_clock::now();
+		memory::Vector_t<ID_t> expired (s.resource);
+		for(auto const &client : s.clients)
+		{
+			Client::Impl const &c = *client.second->impl;
+			if(!c.client && (s.sessions.count(c.token) == 0 || now - c.suspended >= s.grace_period))
+			{
+				expired.push_back(client.first);
+			}
+		}
+		for(ID_t const id : expired)
+		{
+			s.sessions.erase(s.clients.find(id)->second->impl->token);
+			s.expire(id);
+		}
+		if(s.sessions.empty())
+		{
+			timer->stop();
+		}
+	}
+	void lw_callback Server::Impl::lwConnect(lacewing::server server, lacewing::server_client client)
+	{
+		Impl &s = *static_cast<Impl *>(server->tag());
+		if(s.client_IDs.full())
+		{
+			//Refuse the connection rather than give it an ID another client has
+			if(s.onError)
+			{
+				lacewing::error error = lacewing::error_new();
+				error->add("No client IDs left to give a new connection");
+				s.onError(s.interf, error);
+				lacewing::error_delete(error), error = nullptr;
+			}
+			client->close();
+			return;
+		}
+		std::unique_ptr<Client> c (new Client(new Client::Impl(s, client, false)));
+		client->tag(c.get());
+		if(s.grace_period.count() != 0)
+		{
+			c->impl->token = s.newToken();
+		}
+		ID_t const id = c->ID();
+		Client &added = *s.clients.emplace(id, std::move(c)).first->second;
+		if(s.recorder.recording())
+		{
+			s.recorder.record(id, CaptureRecord::Connect);
+		}
+		if(s.onConnect)
+		{
+			LWRELAY_TRACE_SCOPE("onConnect");
+			if(!s.onConnect(s.interf, added).dnd)
+			{
+				//Never accepted, so the disconnect is not reported
+				client->tag(nullptr);
+				s.clients.erase(id);
+				client->close();
+			}
+		}
+	}
+	void lw_callback Server::Impl::lwDisconnect(lacewing::server server, lacewing::server_client client)
+	{
+		Impl &s = *static_cast<Impl *>(server->tag());
+		if(!client->tag())
+		{
+			return; //already torn down
+		}
+		Client &c = *static_cast<Client *>(client->tag());
+		if(s.recorder.recording())
+		{
+			s.recorder.record(c.ID(), CaptureRecord::Disconnect);
+		}
+		if(!c.impl->token.empty())
+		{
+			s.suspend(*c.impl);
+			return;
+		}
+		s.expire(c.ID());
+	}
+	void lw_callback Server::Impl::lwData(lacewing::server server, lacewing::server_client client, char const *data, std::size_t size)
+	{
+		LWRELAY_TRACE_SCOPE("Server receive");
+		Impl &s = *static_cast<Impl *>(server->tag());
+		if(!client->tag())
+		{
+			return; //already torn down
+		}
+		Client &c = *static_cast<Client *>(client->tag());
+		if(s.recorder.recording())
+		{
+			s.recorder.record(c.ID(), CaptureRecord::Data, data, size);
+		}
+		Client::Impl &ci = *c.impl;
+		if(!ci.identified && size != 0)
+		{
+			//Relay clients open with a zero byte, which no HTTP request starts with
+			ci.identified = true;
+			ci.http = (data[0] != 0);
+			if(!ci.http)
+			{
+				++data, --size;
+				if(!ci.outbound.empty())
+				{
+					s.schedule(ci.id); //frames queued before the first byte were held back
+				}
+			}
+		}
+		if(ci.upgraded)
+		{
+			s.unwrap(ci, data, size);
+		}
+		else if(ci.http)
+		{
+			s.upgrade(ci, data, size);
+		}
+		else
+		{
+			s.receive(ci, data, size);
+		}
+	}
+	void Server::Impl::upgrade(Client::Impl &client, char const *data, std::size_t size)
+	{
+		std::size_t const had = client.request.size();
+		client.request.append(data, size);
+		std::size_t const end = client.request.find("\r\n\r\n", (had > 3) ? had - 3 : 0);
+		if(end == std::string::npos)
+		{
+			if(client.request.size() > websocket::MAX_REQUEST)
+			{
+				static char const too_large[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+				client.client->write(too_large, sizeof(too_large) - 1);
+				client.client->close();
+			}
+			return;
+		}
+		bool upgraded;
+		std::string const response = websocket::handshake(client.request.substr(0, end + 4), upgraded);
+		client.client->write(response.data(), response.size());
+		if(!upgraded)
+		{
+			client.client->close();
+			return;
+		}
+		client.upgraded = true;
+		std::string const rest = client.request.substr(end + 4);
+		std::string().swap(client.request);
+		if(!client.outbound.empty())
+		{
+			schedule(client.id);
+		}
+		unwrap(client, rest.data(), rest.size());
+	}
+	void Server::Impl::unwrap(Client::Impl &client, char const *data, std::size_t size)
+	{
+		LWRELAY_TRACE_SCOPE("WebSocket unwrap");
+		bool closing = false;
+		bool const valid = client.websocket.feed(data, size,
+		[&](char const *payload, std::size_t length)
+		{
+			receive(client, payload, length);
+		},
+		[&](websocket::Opcode opcode, std::string const &payload)
+		{
+			char header[websocket::MAX_HEADER];
+			if(opcode == websocket::Opcode::Ping && !client.streaming.stream)
+			{
+				//A pong cannot interrupt a frame being streamed, and browsers do not send pings
+				client.client->write(header, websocket::header(header, websocket::Opcode::Pong, payload.size()));
+				client.client->write(payload.data(), payload.size());
+			}
+			else if(opcode == websocket::Opcode::Close)
+			{
+				closing = true;
+			}
+		});
+		if(!valid || closing)
+		{
+			//Answer with a normal closure, or 1002 for a protocol error
+			std::uint16_t const status = valid ? 1000 : 1002;
+			char frame[websocket::MAX_HEADER + 2];
+			std::size_t n = websocket::header(frame, websocket::Opcode::Close, 2);
+			frame[n++] = static_cast<char>(status >> 8);
+			frame[n++] = static_cast<char>(status & 0xFF);
+			if(!client.streaming.stream)
+			{
+				client.client->write(frame, n);
+			}
+			client.client->close();
+		}
+	}
+	void Server::Impl::receive(Client::Impl &client, char const *data, std::size_t size)
+	{
+		//
+	}
+	void lw_callback Server::Impl::lwError(lacewing::server server, lacewing::error error)
+	{
+		Impl &s = *static_cast<Impl *>(server->tag());
+		if(s.onError)
+		{
+			LWRELAY_TRACE_SCOPE("onError");
+			s.onError(s.interf, error);
+		}
+	}
 	struct Server::Channel::Impl final
-	
+	{
 		Server::Impl &server;
 		IdHolder<ID_t> id;
-		std::string name;
+		Name name;
 		bool autoclose, visible;
-		Clients_t::iterator chmaster;
-		using Clients_t = Server::Impl::Clients_t;
+		Server::Clients_t::iterator chmaster;
+		using Clients_t = memory::Map_t<ID_t, Client *>;
 		Clients_t clients;
 
-		Impl(Server::Impl &si, std::string const &n, Clients_t::iterator creator, bool ac, bool v)
+		//Subchannels each member is subscribed to, for members not subscribed to all of them
+		memory::Map_t<ID_t, std::bitset<256>> subscriptions;
+		//Members grouped by subscription mask, so a send checks each distinct
+		//mask once rather than every member; members without a mask are grouped
+		//under a full one. Rebuilt on the next send after any change.
+		using Recipients_t = memory::Vector_t<Client::Impl *>;
+		struct Group final
+		{
+			std::bitset<256> mask;
+			Recipients_t members;
+		};
+		memory::Vector_t<Group> groups;
+		bool dirty = true;
+
+		//In tick mode, messages are held until the end of the tick and then
+		//written to each member as one batch
+		std::uint32_t tick_ms = 0;
+		lacewing::timer tick_timer = nullptr;
+		struct Pending final
+		{
+			Protocol protocol;
+			Subchannel_t subchannel;
+			frames::Frame_t plain, packed; //packed only if the subchannel is compressed
+		};
+		memory::Vector_t<Pending> pending;
+
+		Impl(Server::Impl &si, std::string const &n, Server::Clients_t::iterator creator, bool ac, bool v)
 		: server(si)
 		, id(si.channel_IDs)
-		, name(n)
+		, name(si.names, n)
 		, autoclose(ac)
 		, visible(v)
 		, chmaster(creator)
+		, clients(si.resource)
+		, subscriptions(si.resource)
+		, groups(si.resource)
+		, pending(si.resource)
 		{
 		}
 		~Impl()
 		{
 			//
+			if(tick_timer)
+			{
+				lacewing::timer_delete(tick_timer), tick_timer = nullptr;
+			}
+		}
+
+		//Must be called whenever members or subscriptions change
+		void invalidate() noexcept
+		{
+			dirty = true;
+		}
+		//Calls f(Client::Impl &) with each member subscribed to the subchannel
+		template<typename F>
+		void forEachRecipient(Subchannel_t subchannel, F &&f)
+		{
+			if(dirty)
+			{
+				rebuild();
+			}
+			for(Group const &group : groups)
+			{
+				if(group.mask[subchannel])
+				{
+					for(Client::Impl *c : group.members)
+					{
+						f(*c);
+					}
+				}
+			}
+		}
+
+		//Writes everything held for the current tick, ahead of anything queued after
+		void deliver()
+		{
+			if(pending.empty())
+			{
+				return;
+			}
+			LWRELAY_TRACE_SCOPE("Channel tick");
+			if(dirty)
+			{
+				rebuild();
+			}
+			//Members with the same mask share one batch per compression setting
+			for(Group const &group : groups)
+			{
+				std::shared_ptr<OutboundBatch> shared[2];
+				OutboundQueue::Priority_t shared_priority[2] = {};
+				for(Client::Impl *c : group.members)
+				{
+					std::shared_ptr<OutboundBatch> &batch = shared[c->compression];
+					OutboundQueue::Priority_t &priority = shared_priority[c->compression];
+					if(!batch)
+					{
+						//The whole batch goes in the most urgent class of any message in it
+						batch = std::allocate_shared<OutboundBatch>(memory::Allocator_t<OutboundBatch>(server.resource), server.resource);
+						priority = OutboundQueue::CLASSES - 1;
+						for(Pending const &p : pending)
+						{
+							if(group.mask[p.subchannel])
+							{
+								batch->append((c->compression && p.packed) ? p.packed : p.plain);
+								priority = std::min(priority, server.priorities[static_cast<std::size_t>(p.protocol)][p.subchannel]);
+							}
+						}
+					}
+					if(batch->size != 0)
+					{
+						server.queue(*c, priority, std::shared_ptr<OutboundBatch const>(batch));
+					}
+				}
+			}
+			pending.clear();
+		}
+		static void lw_callback lwTick(lacewing::timer timer)
+		{
+			static_cast<Impl *>(timer->tag())->deliver();
 		}
 
 		//
+	private:
+		void rebuild()
+		{
+			groups.clear();
+			memory::UnorderedMap_t<std::bitset<256>, std::size_t> index (server.resource);
+			for(auto &member : clients)
+			{
+				Client::Impl *c = member.second->impl.get();
+				auto const mask = subscriptions.find(c->id);
+				std::bitset<256> const m = (mask == subscriptions.end()) ? std::bitset<256>().set() : mask->second;
+				auto const group = index.emplace(m, groups.size());
+				if(group.second)
+				{
+					groups.push_back(Group{m, Recipients_t(server.resource)});
+				}
+				groups[group.first->second].members.push_back(c);
+			}
+			dirty = false;
+		}
 	};
 	Server::Channel &Server::Channel::operator=(Server::Channel &&) noexcept = default;
 
+	void Server::Impl::part(Client::Impl &client)
+	{
+		LWRELAY_TRACE_SCOPE("Channel fan-out (part)");
+		//The remaining members are told on the next flush, along with whoever else leaves by then
+		for(auto const &membership : client.channels)
+		{
+			Channel::Impl &channel = *membership.second->impl;
+			channel.deliver(); //the leaving member was there for the whole tick
+			channel.clients.erase(client.id);
+			channel.subscriptions.erase(client.id);
+			channel.invalidate();
+			if(channel.clients.empty())
+			{
+				departures.erase(channel.id);
+				channels.erase(channel.id);
+				continue;
+			}
+			std::shared_ptr<OutboundBatch> &batch = departures[channel.id];
+			if(!batch)
+			{
+				batch = std::allocate_shared<OutboundBatch>(memory::Allocator_t<OutboundBatch>(resource), resource);
+			}
+			batch->append(frames::peerLeft(resource, channel.id, client.id));
+			notifyLater();
+		}
+		client.channels.clear();
+	}
+	void Server::Impl::notifyLater()
+	{
+		if(!notifying && flushing.empty())
+		{
+			pump->post(reinterpret_cast<void *>(&deferredFlush), new std::weak_ptr<Impl *>(self));
+		}
+		notifying = true;
+	}
+	void Server::Impl::notify()
+	{
+		if(!notifying)
+		{
+			return;
+		}
+		LWRELAY_TRACE_SCOPE("Channel fan-out (departures)");
+		notifying = false;
+		for(auto const &departure : departures)
+		{
+			std::shared_ptr<OutboundBatch const> const batch = departure.second;
+			for(auto const &member : channels.find(departure.first)->second->impl->clients)
+			{
+				queue(*member.second->impl, Protocol::TCP, 0, batch);
+			}
+		}
+		departures.clear();
+		departed.clear();
+	}
+	void Server::Impl::close(Channel::Impl &channel)
+	{
+		LWRELAY_TRACE_SCOPE("Channel fan-out (close)");
+		//Every member is leaving, so none of them is told about the others leaving
+		channel.deliver();
+		frames::Frame_t const frame = frames::leaveChannelResponse(resource, channel.id);
+		for(auto const &member : channel.clients)
+		{
+			Client::Impl &c = *member.second->impl;
+			c.channels.erase(channel.id);
+			queue(c, Protocol::TCP, 0, frame);
+		}
+		departures.erase(channel.id); //nobody is left to tell
+		channels.erase(channel.id);
+	}
+	void Server::Impl::teardown()
+	{
+		//Everyone is leaving, so nobody is sent anything and nothing is erased piecemeal
+		for(auto const &client : clients)
+		{
+			if(onDisconnect)
+			{
+				LWRELAY_TRACE_SCOPE("onDisconnect");
+				onDisconnect(interf, *client.second);
+			}
+			if(lacewing::server_client sc = client.second->impl->client)
+			{
+				sc->tag(nullptr);
+				sc->close();
+			}
+		}
+		if(session_timer->started())
+		{
+			session_timer->stop();
+		}
+		if(drain_timer->started())
+		{
+			drain_timer->stop();
+		}
+		sessions.clear();
+		flushing.clear();
+		stalled.clear();
+		retired.clear();
+		departures.clear();
+		departed.clear();
+		notifying = false;
+		channel_IDs.clear();
+		client_IDs.clear();
+		channels.clear();
+		clients.clear();
+	}
+
 	Server::Server(lacewing::pump pump)
-	: impl(new Impl(*this, pump))
+	: impl(new Impl(*this, pump, memory::defaultResource()))
 	{
 	}
+#ifdef LWRELAY_PMR
+	Server::Server(lacewing::pump pump, std::pmr::memory_resource *resource)
+	: impl(new Impl(*this, pump, resource))
+	{
+	}
+#endif
 	Server::~Server() = default;
 
 	void Server::setChannelListing(bool enabled)
@@ -116,9 +938,53 @@ namespace lwrelay
 	{
 		impl->welcome_message = message;
 	}
-	void Server::host(std::uint16_t port = 6121)
+	void Server::setPriority(Protocol protocol, Subchannel_t subchannel, std::uint8_t priority)
 	{
-		//
+		impl->priorities[static_cast<std::size_t>(protocol)][subchannel] = priority;
+	}
+	void Server::setCompression(Subchannel_t subchannel, bool enabled)
+	{
+		impl->compressed[subchannel] = enabled;
+	}
+	void Server::setCompressionDictionary(std::string const &dictionary)
+	{
+		impl->compressor.dictionary(dictionary);
+	}
+	void Server::setSessionResumption(std::uint32_t grace_ms, std::size_t buffer_size)
+	{
+		impl->grace_period = std::chrono::milliseconds(grace_ms);
+		impl->session_buffer = buffer_size;
+	}
+	void Server::startRecording(std::string const &path)
+	{
+		if(!impl->recorder.open(path) && impl->onError)
+		{
+			lacewing::error error = lacewing::error_new();
+			error->add("Could not open capture file \"%s\"", path.c_str());
+			impl->onError(*this, error);
+			lacewing::error_delete(error), error = nullptr;
+		}
+	}
+	void Server::stopRecording()
+	{
+		impl->recorder.close();
+	}
+	void Server::dumpTrace(std::string const &path, double seconds)
+	{
+		if(!trace::dump(path, seconds) && impl->onError)
+		{
+			lacewing::error error = lacewing::error_new();
+			error->add("Could not write trace file \"%s\"", path.c_str());
+			impl->onError(*this, error);
+			lacewing::error_delete(error), error = nullptr;
+		}
+	}
+	void Server::host(std::uint16_t port)
+	{
+		lacewing::filter filter = lacewing::filter_new();
+		filter->local_port(port);
+		host(filter);
+		lacewing::filter_delete(filter), filter = nullptr;
 	}
 	void Server::host(lacewing::filter filter)
 	{
@@ -130,7 +996,9 @@ namespace lwrelay
 	}
 	void Server::unhost()
 	{
-		//
+		impl->server->unhost();
+		impl->udp->unhost();
+		impl->teardown();
 	}
 	std::uint16_t Server::port() const noexcept
 	{
@@ -162,7 +1030,7 @@ namespace lwrelay
 	}
 	std::string const &Server::Client::name() const noexcept
 	{
-		return impl->name;
+		return impl->name.str();
 	}
 	void Server::Client::name(std::string const &name)
 	{
@@ -180,9 +1048,89 @@ namespace lwrelay
 	{
 		//
 	}
+	bool Server::Client::compression() const noexcept
+	{
+		return impl->compression;
+	}
+	void Server::Client::compression(bool enabled)
+	{
+		impl->compression = enabled;
+	}
+	std::string const &Server::Client::sessionToken() const noexcept
+	{
+		return impl->token;
+	}
+	bool Server::Client::resume(std::string const &token, std::uint64_t received)
+	{
+		Server::Impl &s = impl->server;
+		auto session = s.sessions.find(token);
+		if(!impl->client || session == s.sessions.end())
+		{
+			return false; //suspended or already resumed clients have no connection to give
+		}
+		Client &held = *s.clients.find(session->second)->second;
+		Impl &h = *held.impl;
+		//Walk back from the last frame written to the first one the client did not get
+		std::size_t first = h.history.size() - h.resending;
+		std::uint64_t at = h.sent;
+		while(first != 0 && at > received)
+		{
+			at -= h.history[--first]->size();
+		}
+		s.sessions.erase(session);
+		if(at != received)
+		{
+			return false; //what was lost in flight is no longer held, so the session cannot be restored intact
+		}
+		for(; first != 0; --first)
+		{
+			h.history.pop_front();
+		}
+		h.history_size = 0;
+		h.resending = h.history.size();
+		h.sent = impl->sent; //the new connection's own frames so far
+		s.part(*impl); //this client is about to be destroyed, so no channel may keep it
+		held.impl->client = impl->client, impl->client = nullptr;
+		held.impl->client->tag(&held);
+		held.impl->http = impl->http;
+		held.impl->identified = impl->identified;
+		held.impl->upgraded = impl->upgraded;
+		held.impl->websocket = std::move(impl->websocket);
+		held.impl->compression = impl->compression;
+		held.impl->token = s.newToken();
+		s.schedule(held.ID()); //replay what was missed
+
+		auto fresh = s.clients.find(ID());
+		s.retired.push_back(std::move(fresh->second));
+		s.clients.erase(fresh);
+		return true;
+	}
+	std::size_t Server::Client::footprint() const noexcept
+	{
+		return sizeof(Client) + sizeof(Impl)
+		     + impl->name.footprint()
+		     + impl->channels.footprint()
+		     + impl->token.capacity()
+		     + impl->request.capacity()
+		     + impl->outbound.footprint()
+		     + impl->history.footprint();
+	}
 	void Server::Client::send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data)
 	{
-		//
+		impl->server.checkVariant(subchannel, variant);
+		if(impl->compression && impl->server.compressed[subchannel])
+		{
+			std::string const packed = impl->server.compressor.compress(data);
+			impl->server.queue(*impl, protocol, subchannel, frames::ServerMessage::frame(impl->server.resource, variant | frames::COMPRESSED, subchannel, {}, packed));
+			return;
+		}
+		impl->server.queue(*impl, protocol, subchannel, frames::ServerMessage::frame(impl->server.resource, variant, subchannel, {}, data));
+	}
+	void Server::Client::stream(Subchannel_t subchannel, Variant_t variant, Size_t size, std::function<StreamReader> reader)
+	{
+		impl->server.checkVariant(subchannel, variant);
+		auto s = std::make_shared<OutboundStream>(frames::ServerMessage::prefix(variant, subchannel, {}, size), size, std::move(reader));
+		impl->server.queue(*impl, Protocol::TCP, subchannel, s);
 	}
 
 	Server::Channel::Channel(Impl *i)
@@ -197,15 +1145,15 @@ namespace lwrelay
 	}
 	std::string const &Server::Channel::name() const noexcept
 	{
-		return impl->name;
+		return impl->name.str();
 	}
 	void Server::Channel::name(std::string const &name)
 	{
-		//
+		impl->name = Name(impl->server.names, name);
 	}
 	bool Server::Channel::autoClose() const noexcept
 	{
-		return impl->autclose;
+		return impl->autoclose;
 	}
 	void Server::Channel::autoClose(bool autoclose)
 	{
@@ -215,17 +1163,119 @@ namespace lwrelay
 	{
 		return impl->visible;
 	}
-	void Server::Client::visible(bool visible)
+	void Server::Channel::visible(bool visible)
 	{
 		impl->visible = visible;
 	}
 	void Server::Channel::close()
 	{
-		//
+		impl->server.close(*impl);
 	}
 	void Server::Channel::send(Protocol protocol, Subchannel_t subchannel, Variant_t variant, std::string const &data)
 	{
-		//
+		LWRELAY_TRACE_SCOPE("Channel fan-out");
+		impl->server.checkVariant(subchannel, variant);
+		//Each form of the frame is built at most once and shared by every member receiving it
+		bool const compressed = impl->server.compressed[subchannel];
+		std::string packed;
+		frames::Frame_t plain_frame, packed_frame;
+		if(impl->tick_ms != 0)
+		{
+			Channel::Impl::Pending p {protocol, subchannel, frames::ServerChannelMessage::frame(impl->server.resource, variant, subchannel, {{impl->id}}, data), nullptr};
+			bool wanted = false;
+			if(compressed)
+			{
+				impl->forEachRecipient(subchannel, [&](Client::Impl const &c){ wanted = wanted || c.compression; });
+			}
+			if(wanted)
+			{
+				p.packed = frames::ServerChannelMessage::frame(impl->server.resource, variant | frames::COMPRESSED, subchannel, {{impl->id}}, impl->server.compressor.compress(data));
+			}
+			impl->pending.push_back(std::move(p));
+			return;
+		}
+		impl->forEachRecipient(subchannel, [&](Client::Impl &c)
+		{
+			if(compressed && c.compression)
+			{
+				if(!packed_frame)
+				{
+					packed = impl->server.compressor.compress(data);
+					packed_frame = frames::ServerChannelMessage::frame(impl->server.resource, variant | frames::COMPRESSED, subchannel, {{impl->id}}, packed);
+				}
+				impl->server.queue(c, protocol, subchannel, packed_frame);
+			}
+			else
+			{
+				if(!plain_frame)
+				{
+					plain_frame = frames::ServerChannelMessage::frame(impl->server.resource, variant, subchannel, {{impl->id}}, data);
+				}
+				impl->server.queue(c, protocol, subchannel, plain_frame);
+			}
+		});
+	}
+	void Server::Channel::stream(Subchannel_t subchannel, Variant_t variant, Size_t size, std::function<StreamReader> reader)
+	{
+		LWRELAY_TRACE_SCOPE("Channel fan-out (stream)");
+		impl->server.checkVariant(subchannel, variant);
+		impl->deliver(); //streams are never held, so they must not overtake held messages
+		auto s = std::make_shared<OutboundStream>(frames::ServerChannelMessage::prefix(variant, subchannel, {{impl->id}}, size), size, std::move(reader));
+		impl->forEachRecipient(subchannel, [&](Client::Impl &c)
+		{
+			impl->server.queue(c, Protocol::TCP, subchannel, s);
+		});
+	}
+	std::uint32_t Server::Channel::tickInterval() const noexcept
+	{
+		return impl->tick_ms;
+	}
+	void Server::Channel::tickInterval(std::uint32_t tick_ms)
+	{
+		impl->deliver();
+		impl->tick_ms = tick_ms;
+		if(tick_ms == 0)
+		{
+			if(impl->tick_timer)
+			{
+				impl->tick_timer->stop();
+			}
+			return;
+		}
+		if(!impl->tick_timer)
+		{
+			impl->tick_timer = lacewing::timer_new(impl->server.pump);
+			impl->tick_timer->tag(impl.get());
+			impl->tick_timer->on_tick(Impl::lwTick);
+		}
+		impl->tick_timer->start(tick_ms);
+	}
+	bool Server::Channel::subscribed(Clients_t::iterator member, Subchannel_t subchannel) const
+	{
+		auto mask = impl->subscriptions.find(member->first);
+		return mask == impl->subscriptions.end() || mask->second[subchannel];
+	}
+	void Server::Channel::subscribe(Clients_t::iterator member, Subchannel_t subchannel, bool subscribed)
+	{
+		if(impl->clients.find(member->first) == impl->clients.end())
+		{
+			return;
+		}
+		auto mask = impl->subscriptions.find(member->first);
+		if(mask == impl->subscriptions.end())
+		{
+			if(subscribed)
+			{
+				return;
+			}
+			mask = impl->subscriptions.emplace(member->first, std::bitset<256>().set()).first;
+		}
+		mask->second[subchannel] = subscribed;
+		if(mask->second.all())
+		{
+			impl->subscriptions.erase(mask);
+		}
+		impl->invalidate();
 	}
 	auto Server::Channel::channelMaster()
 	-> Clients_t::iterator
@@ -0,0 +1,170 @@
+#ifndef HotPathTracing_HeaderPlusPlus
+#define HotPathTracing_HeaderPlusPlus
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//Trace points compile to nothing unless LWRELAY_TRACE is defined
+#ifdef LWRELAY_TRACE
+#define LWRELAY_TRACE_CONCAT_(a, b) a##b
+#define LWRELAY_TRACE_CONCAT(a, b) LWRELAY_TRACE_CONCAT_(a, b)
+#define LWRELAY_TRACE_SCOPE(name) ::lwrelay::trace::Scope const LWRELAY_TRACE_CONCAT(lwrelay_trace_, __LINE__) (name)
+#else
+#define LWRELAY_TRACE_SCOPE(name) static_cast<void>(0)
+#endif
+
+namespace lwrelay
+{
+	//Each thread records timed scopes into its own ring buffer, which only it
+	//writes to, so recording a scope takes two timestamp reads and no locks. Rings are
+	//never freed, so a dump still sees the events of threads that have exited.
+	//A dump may read a ring while its thread writes to it, so each slot is a
+	//seqlock: a slot is read only if it held the same event before and after.
+	namespace trace
+	{
+		inline std::uint64_t now() noexcept
+		{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#else
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+		}
+
+		struct Event final
+		{
+			std::uint64_t begin, end;
+			char const *name;
+		};
+		//Holds event i of its ring once seq is 2i + 2; it is odd while being written
+		struct Slot final
+		{
+			std::atomic<std::uint64_t> seq {0}, begin {0}, end {0};
+			std::atomic<char const *> name {nullptr};
+		};
+		struct Ring final
+		{
+			static constexpr std::size_t SIZE = 1 << 16;
+			std::array<Slot, SIZE> slots;
+			std::atomic<std::uint64_t> head {0};
+			std::size_t tid;
+		};
+		struct Registry final
+		{
+			std::mutex mutex;
+			std::vector<Ring *> rings;
+			//Pairs a tick count with a clock time, to convert ticks to time
+			std::uint64_t const ticks0 = now();
+			std::chrono::steady_clock::time_point const time0 = std::chrono::steady_clock::now();
+		};
+		inline Registry &registry()
+		{
+			static Registry r;
+			return r;
+		}
+		inline Ring &ring()
+		{
+			thread_local Ring *r = []
+			{
+				Registry &reg = registry();
+				std::lock_guard<std::mutex> lock (reg.mutex);
+				Ring *created = new Ring;
+				created->tid = reg.rings.size();
+				reg.rings.push_back(created);
+				return created;
+			}();
+			return *r;
+		}
+		struct Scope final
+		{
+			Ring &r;
+			char const *const name;
+			std::uint64_t const begin;
+
+			Scope(char const *n) noexcept
+			: r(ring())
+			, name(n)
+			, begin(now())
+			{
+			}
+			~Scope()
+			{
+				std::uint64_t const end = now();
+				std::uint64_t const h = r.head.load(std::memory_order_relaxed);
+				Slot &slot = r.slots[h & (Ring::SIZE - 1)];
+				slot.seq.store(2*h + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				slot.begin.store(begin, std::memory_order_relaxed);
+				slot.end.store(end, std::memory_order_relaxed);
+				slot.name.store(name, std::memory_order_relaxed);
+				slot.seq.store(2*h + 2, std::memory_order_release);
+				r.head.store(h + 1, std::memory_order_release);
+			}
+		};
+
+		//Copies event i out of its slot, unless the slot's thread has moved on
+		//to a later event there
+		inline bool read(Slot const &slot, std::uint64_t i, Event &e) noexcept
+		{
+			std::uint64_t const seq = slot.seq.load(std::memory_order_acquire);
+			e.begin = slot.begin.load(std::memory_order_relaxed);
+			e.end = slot.end.load(std::memory_order_relaxed);
+			e.name = slot.name.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return seq == 2*i + 2 && slot.seq.load(std::memory_order_relaxed) == seq;
+		}
+
+		//Writes the events that ended in the last given number of seconds as
+		//Chrome trace event JSON, which Perfetto also reads
+		inline bool dump(std::string const &path, double seconds)
+		{
+			Registry &reg = registry();
+			std::uint64_t const ticks = now();
+			double const elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - reg.time0).count();
+			double const per_us = (elapsed > 0.0) ? static_cast<double>(ticks - reg.ticks0) / elapsed : 1.0;
+			double const window = seconds*1e6*per_us;
+			std::uint64_t const cutoff = (window < static_cast<double>(ticks - reg.ticks0)) ? ticks - static_cast<std::uint64_t>(window) : reg.ticks0;
+
+			std::FILE *file = std::fopen(path.c_str(), "w");
+			if(!file)
+			{
+				return false;
+			}
+			std::fputs("{\"traceEvents\":[", file);
+			bool first = true;
+			std::lock_guard<std::mutex> lock (reg.mutex);
+			std::uint64_t const capacity = Ring::SIZE;
+			for(Ring const *r : reg.rings)
+			{
+				std::uint64_t const h = r->head.load(std::memory_order_acquire);
+				for(std::uint64_t i = h - std::min(h, capacity); i < h; ++i)
+				{
+					Event e;
+					if(!read(r->slots[i & (Ring::SIZE - 1)], i, e) || e.end < cutoff || e.begin < reg.ticks0)
+					{
+						continue; //overwritten since the dump started, or too old
+					}
+					std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+						first ? "" : ",", e.name, static_cast<unsigned>(r->tid),
+						static_cast<double>(e.begin - reg.ticks0)/per_us, static_cast<double>(e.end - e.begin)/per_us);
+					first = false;
+				}
+			}
+			std::fputs("\n]}\n", file);
+			return std::fclose(file) == 0;
+		}
+	}
+}
+
+#endif
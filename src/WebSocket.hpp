@@ -0,0 +1,269 @@
+#ifndef WebSocketGateway_HeaderPlusPlus
+#define WebSocketGateway_HeaderPlusPlus
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace lwrelay
+{
+	//Lets browsers connect to the relay server directly: the HTTP upgrade
+	//handshake, and the framing that carries relay protocol data in binary
+	//WebSocket messages (RFC 6455).
+	namespace websocket
+	{
+		enum struct Opcode : std::uint8_t
+		{
+			Continuation = 0x0,
+			Text         = 0x1,
+			Binary       = 0x2,
+			Close        = 0x8,
+			Ping         = 0x9,
+			Pong         = 0xA
+		};
+
+		//Headers of frames sent by the server, which are never masked
+		constexpr std::size_t MAX_HEADER = 2 + 8;
+		//Largest HTTP request accepted before the upgrade
+		constexpr std::size_t MAX_REQUEST = 8*1024;
+
+		inline std::array<std::uint8_t, 20> sha1(std::string const &message)
+		{
+			std::uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+			auto const rotl = [](std::uint32_t v, int n){ return (v << n) | (v >> (32 - n)); };
+
+			std::string m = message;
+			std::uint64_t const bits = static_cast<std::uint64_t>(message.size())*8;
+			m += static_cast<char>(0x80);
+			m.append((64 + 56 - m.size() % 64) % 64, '\0');
+			for(int i = 7; i >= 0; --i)
+			{
+				m += static_cast<char>((bits >> (i*8)) & 0xFF);
+			}
+			for(std::size_t block = 0; block < m.size(); block += 64)
+			{
+				std::uint32_t w[80];
+				for(int i = 0; i < 16; ++i)
+				{
+					unsigned char const *p = reinterpret_cast<unsigned char const *>(m.data() + block + i*4);
+					w[i] = (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+				}
+				for(int i = 16; i < 80; ++i)
+				{
+					w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+				}
+				std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+				for(int i = 0; i < 80; ++i)
+				{
+					std::uint32_t f, k;
+					if(i < 20)      f = (b & c) | (~b & d),          k = 0x5A827999;
+					else if(i < 40) f = b ^ c ^ d,                   k = 0x6ED9EBA1;
+					else if(i < 60) f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+					else            f = b ^ c ^ d,                   k = 0xCA62C1D6;
+					std::uint32_t const t = rotl(a, 5) + f + e + k + w[i];
+					e = d, d = c, c = rotl(b, 30), b = a, a = t;
+				}
+				h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+			}
+			std::array<std::uint8_t, 20> digest;
+			for(int i = 0; i < 20; ++i)
+			{
+				digest[i] = static_cast<std::uint8_t>(h[i/4] >> (24 - (i%4)*8));
+			}
+			return digest;
+		}
+		template<std::size_t N>
+		std::string base64(std::array<std::uint8_t, N> const &bytes)
+		{
+			static char const alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			std::string out;
+			for(std::size_t i = 0; i < N; i += 3)
+			{
+				std::uint32_t const v = (std::uint32_t(bytes[i]) << 16)
+				                      | (i + 1 < N ? std::uint32_t(bytes[i + 1]) << 8 : 0)
+				                      | (i + 2 < N ? std::uint32_t(bytes[i + 2]) : 0);
+				out += alphabet[(v >> 18) & 0x3F];
+				out += alphabet[(v >> 12) & 0x3F];
+				out += (i + 1 < N) ? alphabet[(v >> 6) & 0x3F] : '=';
+				out += (i + 2 < N) ? alphabet[v & 0x3F] : '=';
+			}
+			return out;
+		}
+
+		//Returns the response to a complete HTTP request, switching protocols if
+		//it asks to upgrade to a WebSocket, or an error response otherwise
+		inline std::string handshake(std::string const &request, bool &upgraded)
+		{
+			auto const lower = [](std::string s){ return std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); }), s; };
+			auto const trim = [](std::string const &s)
+			{
+				std::size_t const first = s.find_first_not_of(" \t");
+				return (first == std::string::npos) ? std::string() : s.substr(first, s.find_last_not_of(" \t") - first + 1);
+			};
+			std::string key;
+			bool upgrade = false;
+			std::size_t line = request.find("\r\n");
+			if(request.compare(0, 4, "GET ") == 0)
+			{
+				while(line != std::string::npos && line + 2 < request.size())
+				{
+					std::size_t const next = request.find("\r\n", line + 2);
+					std::string const field = request.substr(line + 2, next - line - 2);
+					std::size_t const colon = field.find(':');
+					if(colon != std::string::npos)
+					{
+						std::string const name = lower(trim(field.substr(0, colon)));
+						std::string const value = trim(field.substr(colon + 1));
+						if(name == "upgrade")
+						{
+							upgrade = (lower(value) == "websocket");
+						}
+						else if(name == "sec-websocket-key")
+						{
+							key = value;
+						}
+					}
+					line = next;
+				}
+			}
+			upgraded = upgrade && !key.empty();
+			if(!upgraded)
+			{
+				return "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+			}
+			return "HTTP/1.1 101 Switching Protocols\r\n"
+			       "Upgrade: websocket\r\n"
+			       "Connection: Upgrade\r\n"
+			       "Sec-WebSocket-Accept: " + base64(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11")) + "\r\n\r\n";
+		}
+
+		//Writes the header of a final, unmasked frame, returning the length written
+		inline std::size_t header(char *out, Opcode opcode, std::uint64_t length) noexcept
+		{
+			out[0] = static_cast<char>(0x80 | static_cast<std::uint8_t>(opcode));
+			if(length < 126)
+			{
+				return out[1] = static_cast<char>(length), 2;
+			}
+			int const bytes = (length <= 0xFFFF) ? 2 : 8;
+			out[1] = static_cast<char>((bytes == 2) ? 126 : 127);
+			for(int i = 0; i < bytes; ++i)
+			{
+				out[2 + i] = static_cast<char>((length >> ((bytes - 1 - i)*8)) & 0xFF);
+			}
+			return 2 + bytes;
+		}
+
+		//Unwraps the frames sent by a client as they arrive. Data frames are
+		//unmasked and handed on in whatever pieces they arrive in, without
+		//waiting for the rest of the frame; only headers and the small payloads
+		//of control frames are buffered.
+		struct Decoder final
+		{
+			//Calls data(char const *, std::size_t) with the payload of data frames
+			//and control(Opcode, std::string const &) with each control frame,
+			//returning false if the client broke the protocol
+			template<typename Data, typename Control>
+			bool feed(char const *in, std::size_t size, Data &&data, Control &&control)
+			{
+				while(size != 0 || (in_frame && remaining == 0))
+				{
+					if(!in_frame)
+					{
+						std::size_t need = 2;
+						if(have >= 2)
+						{
+							std::uint8_t const length = static_cast<std::uint8_t>(head[1]) & 0x7F;
+							need += ((length == 126) ? 2 : (length == 127) ? 8 : 0) + 4;
+						}
+						std::size_t const take = std::min(need - have, size);
+						std::copy(in, in + take, head + have);
+						have += take, in += take, size -= take;
+						if(have == need && need != 2 && !start())
+						{
+							return false;
+						}
+						continue;
+					}
+					std::size_t const take = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, size));
+					unmasked.resize(take);
+					for(std::size_t i = 0; i < take; ++i, ++phase)
+					{
+						unmasked[i] = static_cast<char>(in[i] ^ mask[phase & 3]);
+					}
+					in += take, size -= take, remaining -= take;
+					if(isControl())
+					{
+						payload += unmasked;
+					}
+					else if(take != 0)
+					{
+						data(unmasked.data(), take);
+					}
+					if(remaining == 0)
+					{
+						in_frame = false;
+						if(isControl())
+						{
+							control(opcode, payload);
+							payload.clear();
+						}
+					}
+				}
+				return true;
+			}
+
+		private:
+			char head[2 + 8 + 4];
+			std::size_t have = 0;
+			bool in_frame = false;
+			Opcode opcode = Opcode::Binary;
+			std::uint64_t remaining = 0;
+			std::uint8_t mask[4];
+			std::size_t phase = 0;
+			std::string unmasked; //scratch space reused for every piece
+			std::string payload; //of the control frame being received
+
+			bool isControl() const noexcept
+			{
+				return static_cast<std::uint8_t>(opcode) >= 0x8;
+			}
+			//Parses a complete frame header
+			bool start() noexcept
+			{
+				std::uint8_t const first = static_cast<std::uint8_t>(head[0]);
+				std::uint8_t const second = static_cast<std::uint8_t>(head[1]);
+				std::size_t const extended = have - 2 - 4;
+				remaining = second & 0x7F;
+				if(extended != 0)
+				{
+					remaining = 0;
+					for(std::size_t i = 0; i < extended; ++i)
+					{
+						remaining = (remaining << 8) | static_cast<std::uint8_t>(head[2 + i]);
+					}
+				}
+				std::copy(head + 2 + extended, head + have, mask);
+				have = 0, phase = 0, in_frame = true;
+				Opcode const op = static_cast<Opcode>(first & 0x0F);
+				if((first & 0x70) != 0 || (second & 0x80) == 0)
+				{
+					return false; //extensions were not negotiated, and clients must mask
+				}
+				switch(op)
+				{
+					case Opcode::Continuation: case Opcode::Binary:
+						return opcode = op, true;
+					case Opcode::Close: case Opcode::Ping: case Opcode::Pong:
+						return opcode = op, ((first & 0x80) != 0 && remaining <= 125);
+					default:
+						return false; //relay data is binary, never text
+				}
+			}
+		};
+	}
+}
+
+#endif